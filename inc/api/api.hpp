@@ -1,18 +1,42 @@
 #pragma once
 
+#include "platform.hpp"
 #include "functional.hpp"
 
+#if defined(CYNTH_API_NULL)
+#include "api/null/wrapper.hpp"
+#else
 #include "api/asio/wrapper.hpp"
 //#include "api/wasapi/wrapper.hpp"
+#endif
 
 namespace cynth::api {
 
-    class init: public asio::wrapper {};
-    //class api_init: public wasapi::wrapper {};
+    #if defined(CYNTH_API_NULL)
+    namespace backend = null;
+    #else
+    namespace backend = asio;
+    //namespace backend = wasapi;
+    #endif
+
+    class init: public backend::wrapper {
+    public:
+        using backend::wrapper::wrapper;
+    };
 
     struct driver {
-        inline static wave_function& input = asio::driver::sample;
-        //inline static wave_function& input = wasapi::driver::sample;
+        static void set_input (const wave_function& input, parallel_tools::worker_pool* pool = nullptr) { backend::driver::set_input(input, pool); }
+
+        // Timing of the audio callbacks so far (see callback_monitor).
+        static callback_monitor::statistics statistics () { return backend::driver::monitor.read(); }
+        static void reset_statistics () { backend::driver::monitor.reset(); }
+
+        // Sets a parameter (see wave_function::parameter) to value from the given sample on, without locking.
+        // Meant for a single control thread. Returns false when the queue is full.
+        static bool send (floating_t& target, floating_t value, unsigned_t time) { return backend::driver::events.push({&target, value, time}); }
+        // First sample of the next block of the audio thread, to schedule events relative to.
+        // An event sent for it or later is applied at its sample, the same in every backend.
+        static unsigned_t position () { return backend::driver::sample_position.load(std::memory_order_relaxed); }
     };
 
-}
\ No newline at end of file
+}
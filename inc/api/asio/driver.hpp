@@ -5,7 +5,11 @@
 #include "exceptions.hpp"
 #include "api/asio/tools.hpp"
 #include "api/asio/buffertools.hpp"
+#include "api/monitor.hpp"
+#include "api/events.hpp"
 #include "functional.hpp"
+#include "compiled_function.hpp"
+#include "paralleltools.hpp"
 
 #include "wavetables.hpp"
 #include "devices/oscillator.hpp" 
@@ -21,8 +25,9 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <memory>
+#include <algorithm>
 #include <mutex>
-#include <shared_mutex>
 #include <condition_variable>
 #include <atomic>
 #include <thread>
@@ -63,6 +68,13 @@ namespace cynth::api::asio {
             driver::create_buffers();
             driver::get_channel_info();
             driver::get_latencies();
+            // The callbacks run on a thread of the driver: Its first read of the program takes this record
+            // instead of allocating one.
+            parallel_tools::hazards::reserve(1);
+            // The callbacks are not running yet, a program kept from before a reset follows the new sample rate:
+            if (auto current = driver::program.read())
+                current->resample();
+            driver::program.done();
         }
 
         static void init () {
@@ -100,7 +112,8 @@ namespace cynth::api::asio {
             ASIOGetSampleRate(&sample_rate) >> ase_handler{"ASIOGetSampleRate"};
             // TODO: ASIOCanSampleRate, ASIOSetSampleRate when the sample rate is not stored in the driver.
             driver::sample_rate = tools::native_floating(sample_rate);
-            wave_function::sample_rate = driver::sample_rate;
+            wave_function::sample_rate   = driver::sample_rate;
+            wave_function::sample_length = 1 / driver::sample_rate;
         }
 
         static void check_outready_optimization () {
@@ -142,6 +155,9 @@ namespace cynth::api::asio {
                 driver::input_channel_count + driver::output_channel_count,
                 driver::preferred_buffer_size,
                 &driver::callbacks) >> ase_handler{"ASIOCreateBuffers"};
+            // Allocated here, so that the callbacks never allocate:
+            driver::render_buffer.resize(driver::preferred_buffer_size);
+            driver::monitor.set_period(driver::preferred_buffer_size / driver::sample_rate);
         }
 
         static void get_channel_info () {
@@ -196,40 +212,71 @@ namespace cynth::api::asio {
         inline static unsigned_t      system_reference_time;
         //inline static unsigned_t      processed_sample_count;
         inline static ASIOCallbacks   callbacks;
+        inline static std::vector<floating_t> render_buffer; // One block of rendered samples shared by all output channels.
+        inline static callback_monitor        monitor;       // Timing of buffer_switch_time_info, readable from any thread.
+        inline static event_queue             events {event_capacity};
+        inline static std::atomic<unsigned_t> sample_position; // First sample of the next block.
         
-        enum stop_enum { FULL, RESET, SRATE_RESET };
+        // Lifecycle of the driver. Only RUNNING lets the callbacks touch the buffers.
+        // The other states are requests to the thread running wrapper::start, which brings the driver
+        // to a halt (ASIOStop) and waits for the callbacks in flight before it disposes or recreates anything.
+        enum state_enum { STOPPED, RUNNING, STOPPING, RESETTING, SRATE_RESETTING };
+        inline static std::atomic<state_enum> state {STOPPED};
+        inline static std::atomic<unsigned_t> in_flight {0}; // Callbacks between enter() and leave().
         inline static std::mutex              stop_mutex;
-        inline static std::shared_mutex       operation_mutex;
         inline static std::condition_variable stop_signal;
-        inline static std::atomic<stop_enum>  stop_type;
 
-        static void request_stop (stop_enum type = FULL) {
-            driver::stop_type = type;
+        // Only the first request counts, the later ones arrive while the driver is already on its way down.
+        static void request_stop (state_enum type = STOPPING) {
+            auto expected = RUNNING;
+            if (!driver::state.compare_exchange_strong(expected, type, std::memory_order_seq_cst))
+                return;
+            // Taken so that the notification cannot fall between the check and the wait in wrapper::start:
+            std::lock_guard<std::mutex> guard{driver::stop_mutex};
             driver::stop_signal.notify_all();
         }
 
-        static void buffer_switch (long index, ASIOBool direct_process) {
-            {
-                std::shared_lock<std::shared_mutex> guard{operation_mutex, std::try_to_lock};
-                if (!guard.owns_lock())
-                    return;
+        // The only synchronization on the audio path: A callback may use the buffers when enter() returns true,
+        // until it calls leave(). The counter is raised before the state is checked (both sequentially consistent),
+        // so once the state has left RUNNING and wait_idle() has returned, no callback uses them anymore.
+        static bool enter () {
+            driver::in_flight.fetch_add(1, std::memory_order_seq_cst);
+            if (driver::state.load(std::memory_order_seq_cst) == RUNNING)
+                return true;
+            driver::leave();
+            return false;
+        }
+
+        static void leave () {
+            driver::in_flight.fetch_sub(1, std::memory_order_release);
+        }
+
+        // Called by wrapper::start after a request to stop, before the buffers are disposed.
+        static void wait_idle () {
+            while (driver::in_flight.load(std::memory_order_seq_cst))
+                std::this_thread::yield();
+        }
 
-                // From the docks: a timeInfo needs to be created though it will only set the timeInfo.samplePosition and timeInfo.systemTime fields and the according flags
-                ASIOTime time{};
+        static void buffer_switch (long index, ASIOBool direct_process) {
+            (void) direct_process;
 
-                // From the docs: get the time stamp of the buffer (for synchronization with other media)
-                if (ASIOGetSamplePosition(&time.timeInfo.samplePosition, &time.timeInfo.systemTime) == ASE_OK)
-                    time.timeInfo.flags = AsioTimeInfoFlags::kSystemTimeValid | AsioTimeInfoFlags::kSamplePositionValid;
+            if (!driver::enter()) {
+                driver::monitor.skip();
+                return;
             }
 
-            driver::buffer_switch_time_info (&time, index, direct_process);
+            // From the docks: a timeInfo needs to be created though it will only set the timeInfo.samplePosition and timeInfo.systemTime fields and the according flags
+            ASIOTime time{};
+
+            // From the docs: get the time stamp of the buffer (for synchronization with other media)
+            if (ASIOGetSamplePosition(&time.timeInfo.samplePosition, &time.timeInfo.systemTime) == ASE_OK)
+                time.timeInfo.flags = AsioTimeInfoFlags::kSystemTimeValid | AsioTimeInfoFlags::kSamplePositionValid;
+
+            driver::process(&time, index);
+            driver::leave();
         }
 
         static void sample_rate_changed (ASIOSampleRate sRate) {
-            std::shared_lock<std::shared_mutex> guard{operation_mutex, std::try_to_lock};
-            if (!guard.owns_lock())
-                return;
-
             /* From the docs:
                 Do whatever you need to do if the sample rate changed.
                 Usually this only happens during external sync.
@@ -238,17 +285,14 @@ namespace cynth::api::asio {
                 AES/EBU or S/PDIF digital input at the audio device.
                 You might have to update time/sample related conversion routines, etc. */
             
-            driver::request_stop(SRATE_RESET);
+            driver::request_stop(SRATE_RESETTING);
         }
 
         static long asio_messages (long selector, long value, void* message, double* opt) {
             (void) message;
             (void) opt;
 
-            std::shared_lock<std::shared_mutex> guard{operation_mutex, std::try_to_lock};
-            if (!guard.owns_lock())
-                return 0;
-            
+            // The requests to stop are ignored unless the driver is running (see request_stop).
             // TODO: This was just coppied from the docs.
             // The messages, that are not implemented perform a full stop of the driver.
             switch (selector) {
@@ -271,7 +315,7 @@ namespace cynth::api::asio {
                     You cannot reset the driver right now, as this code is called from the driver.
                     Reset the driver is done by completely destruct is. I.e. ASIOStop(), ASIODisposeBuffers(), Destruction
                     Afterwards you initialize the driver again. */
-                driver::request_stop(RESET);
+                driver::request_stop(RESETTING);
                 return 1;
             case kAsioResyncRequest:
                 /* From the docs:
@@ -303,8 +347,7 @@ namespace cynth::api::asio {
                     is supported.
                     For compatibility with ASIO 1.0 drivers the host application should always support
                     the "old" bufferSwitch method, too. */
-                /*driver::stop_type = FULL;
-                driver::stop_signal.notify_all();*/
+                //driver::request_stop();
                 return 1;
             case kAsioSupportsTimeCode:
                 /* From the docs:
@@ -317,14 +360,33 @@ namespace cynth::api::asio {
             return 0;
         }
 
-        static inline wave_function sample;
+        inline static parallel_tools::rcu_slot<compiled_function<floating_t>> program;
+
+        // The graph is compiled on the calling thread and published to the callback, which picks it up
+        // at its next buffer without ever waiting. The previous program is destroyed here.
+        // The graph must outlive its use by the driver.
+        // With a worker pool, the blocks are rendered by all of its threads.
+        static void set_input (const wave_function& input, parallel_tools::worker_pool* pool = nullptr) {
+            driver::program.publish(std::make_unique<compiled_function<floating_t>>(input, 1, 0, pool));
+        }
 
         static ASIOTime* buffer_switch_time_info (ASIOTime* time_ptr, long index, ASIOBool direct_process) {
-            // TODO: Docs, page 8: First few call to bufferSwitch should be ignored.
+            (void) direct_process;
 
-            std::shared_lock<std::shared_mutex> guard{operation_mutex, std::try_to_lock};
-            if (!guard.owns_lock())
+            // TODO: Docs, page 8: First few call to bufferSwitch should be ignored.
+            if (!driver::enter()) {
+                driver::monitor.skip();
                 return 0;
+            }
+
+            driver::process(time_ptr, index);
+            driver::leave();
+            return 0;
+        }
+
+        // Renders one buffer. Called by the two buffer switch callbacks between enter() and leave().
+        static void process (ASIOTime* time_ptr, long index) {
+            auto start = driver::monitor.begin();
 
             // From the docs: store the timeInfo for later use
             driver::time = *time_ptr;
@@ -336,6 +398,9 @@ namespace cynth::api::asio {
             driver::sample_pos_samples = time_ptr->timeInfo.flags & kSamplePositionValid
                 ? tools::native_floating(time_ptr->timeInfo.samplePosition)
                 : 0;
+            auto position = time_ptr->timeInfo.flags & kSamplePositionValid
+                ? tools::native_integral(time_ptr->timeInfo.samplePosition)
+                : 0;
             driver::time_code_samples = time_ptr->timeCode.flags & kTcValid
                 ? tools::native_floating(time_ptr->timeCode.timeCodeSamples)
                 : 0;
@@ -344,7 +409,20 @@ namespace cynth::api::asio {
             driver::system_reference_time = timeGetTime(); // TODO: From which header is this?
 
             auto buffer_size = driver::preferred_buffer_size;
-            
+            auto block       = driver::render_buffer.data();
+
+            // The whole block is rendered once and then copied to all the output channels.
+            // It is split at the parameter events due in it:
+            auto program = driver::program.read();
+            render_events(driver::events, position, buffer_size, [&] (std::size_t offset, std::size_t count) {
+                if (program)
+                    program->render((driver::sample_pos_samples + offset) / driver::sample_rate, 1 / driver::sample_rate, block + offset, count);
+                else
+                    std::fill(block + offset, block + offset + count, floating_t{0});
+            });
+            driver::program.done();
+            driver::sample_position.store(position + buffer_size, std::memory_order_relaxed);
+
             for (std::size_t i = 0; i < driver::input_buffer_count + driver::output_buffer_count; ++i) {
                 auto& buffer_info  = driver::buffer_infos[i];
                 auto& channel_info = driver::channel_infos[i];
@@ -352,9 +430,8 @@ namespace cynth::api::asio {
                     auto buff = buffer{buffer_info.buffers[index], channel_info.type, buffer_size};
                     {
                         unsigned_t j = 0; for (auto&& s: buff) {
-                            auto seconds = (sample_pos_samples + j) / driver::sample_rate;
-                            s = driver::sample(seconds);
-                            //std::cout << sample_pos_samples + j << ": " << std::to_string(driver::sample(seconds)) << '\n';
+                            s = block[j];
+                            //std::cout << sample_pos_samples + j << ": " << std::to_string(block[j]) << '\n';
                             ++j;
                         }
                     }
@@ -365,7 +442,7 @@ namespace cynth::api::asio {
             if (driver::outready_optimization)
                 ASIOOutputReady() >> ase_handler{"ASIOOutputReady"};
 
-            return 0;
+            driver::monitor.end(start);
         }
     };
 }
\ No newline at end of file
@@ -22,6 +22,10 @@ namespace cynth::api::asio::tools {
     floating_t native_floating (double from) { return static_cast<floating_t>(from); }
     template <typename T, typename... Dummy> floating_t native_floating (T aggr, Dummy...) { return aggr.lo + static_cast<floating_t>(aggr.hi) * (1ULL << 32); }
 
+    // Exact, unlike native_floating (e.g. sample positions):
+    unsigned_t native_integral (double from) { return static_cast<unsigned_t>(from); }
+    template <typename T, typename... Dummy> unsigned_t native_integral (T aggr, Dummy...) { return aggr.lo + (static_cast<unsigned_t>(aggr.hi) << 32); }
+
     std::size_t sample_type_size_bytes (ASIOSampleType type) {
         switch(type) {
         case ASIOSTInt16MSB:
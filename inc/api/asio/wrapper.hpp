@@ -81,47 +81,51 @@ namespace cynth::api::asio {
             driver::full_init();
             
             while (true) {
+                /* The stopping process:
+
+                The callbacks render only while the state is RUNNING, and count themselves in flight meanwhile
+                (driver::enter and driver::leave), which costs them two atomic operations and a load.
+                A request to stop or reset (request_stop) moves the state away from RUNNING exactly once
+                and wakes this thread. From then on, the callbacks return immediately.
+                After ASIOStop, this thread waits until no callback is in flight, so the buffers
+                are disposed and the driver reinitialized only once nothing renders into them,
+                whether or not the driver waited for its callbacks in ASIOStop.
+                The state is published with a release store and read with acquire loads,
+                so the callbacks see everything full_init has set up before RUNNING.
+                */
+
+                driver::state.store(driver::RUNNING, std::memory_order_release);
                 std::cout << "ASIOStart()\n";
                 ASIOStart() >> ase_handler{"ASIOStart"};
-                //break;
-
-                /* The locking process:
-
-                ASIO callbacks remain lock-free as they acquire a shared ownership of the operation_mutex.
-                These callbacks owning the operation_mutex means, that at this moment
-                it is not safe to dispose buffers or even exit ASIO completely (ASIODisposeBuffers, ASIOExit).
-                To stop or reset ASIO, the operation_mutex must be owned exclusively.
-                When anyone manages to acquire exclusive ownership,
-                ASIO callbacks fail to acquire shared ownership and return immediately.
-                Callbacks that are writing to buffers cannot write when the mutex is owned exclusively
-                as the driver may be in the process of stopping/restarting and the buffers may not be valid.
-                Callbacks that are responsible for various events notifications are simply ignored,
-                as no such events are relevant when the driver is stopping/restarting.
-                TODO: Check if my understanding of shared/exclusive ownership if correct.
-                */
 
-                std::unique_lock<std::mutex> stop_guard{driver::stop_mutex};
-                driver::stop_signal.wait(stop_guard);
-                std::unique_lock<std::shared_mutex> operation_guard{driver::operation_mutex};
+                driver::state_enum request;
+                {
+                    // The predicate keeps spurious wakeups from stopping the driver:
+                    std::unique_lock<std::mutex> stop_guard{driver::stop_mutex};
+                    driver::stop_signal.wait(stop_guard, [&request] {
+                        request = driver::state.load(std::memory_order_acquire);
+                        return request != driver::RUNNING;
+                    });
+                }
 
-                switch (driver::stop_type) {
-                case driver::stop_enum::RESET:
-                    ASIOStop() >> ase_handler{"ASIOStop"};
+                ASIOStop() >> ase_handler{"ASIOStop"};
+                std::cout << "ASIOStop()\n";
+                driver::wait_idle();
+
+                switch (request) {
+                case driver::RESETTING:
+                case driver::SRATE_RESETTING:
+                    // A new sample rate is picked up by the reinitialization as well:
                     ASIODisposeBuffers() >> ase_handler{"ASIODisposeBuffers"};
                     ASIOExit() >> ase_handler{"ASIOExit"};
                     driver::full_init();
                     continue;
-                case driver::stop_enum::SRATE_RESET:
-                    // TODO
-                    driver::full_init();
-                    continue;
-                case driver::stop_enum::FULL:
+                case driver::STOPPING:
                 default:
                     break;
                 }
 
-                ASIOStop() >> ase_handler{"ASIOStop"};
-                std::cout << "ASIOStop()\n";
+                driver::state.store(driver::STOPPED, std::memory_order_release);
                 break;
             }
         }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "config.hpp"
+#include "paralleltools.hpp"
+
+#include <cstddef>
+
+namespace cynth::api {
+
+    // A new value of a parameter (see wave_function::parameter) from a given sample of the output on.
+    // Once a parameter is driven by events, the audio thread is the only one writing it.
+    struct parameter_event {
+        floating_t* target;
+        floating_t  value;
+        unsigned_t  time;   // Sample position, as counted by the driver.
+    };
+
+    // From a control thread to the audio thread. Timestamps should not decrease.
+    using event_queue = parallel_tools::spsc_queue<parameter_event>;
+
+    inline constexpr std::size_t event_capacity = 1024;
+
+    // Renders the block of n samples starting at sample `position` by render(offset, count), split so that
+    // every event due in the block is applied right before its sample. Late events are applied at the start,
+    // events for the following blocks are left in the queue.
+    template <typename Render>
+    void render_events (event_queue& queue, unsigned_t position, std::size_t n, Render&& render) {
+        std::size_t offset = 0;
+        while (auto event = queue.front()) {
+            if (event->time >= position + n)
+                break;
+            std::size_t at = event->time > position ? static_cast<std::size_t>(event->time - position) : 0;
+            if (at > offset) {
+                render(offset, at - offset);
+                offset = at;
+            }
+            *event->target = event->value;
+            queue.pop();
+        }
+        if (offset < n)
+            render(offset, n - offset);
+    }
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+namespace cynth::api {
+
+    // Timing statistics of the audio callbacks: Render time, headroom left in the buffer period,
+    // deadlines missed by the render, callbacks skipped by the driver or missed entirely (judged
+    // by the gap between two callbacks) and a histogram of the render time relative to the period.
+    // Only the audio thread writes. Every value is a separate relaxed atomic, so recording never waits
+    // and any thread may read at any time. A reading may mix two consecutive callbacks.
+    class callback_monitor {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // Bucket i counts renders taking [i, i + 1) tenths of the period, the last one everything longer.
+        inline constexpr static std::size_t bucket_count = 16;
+
+        struct statistics {
+            unsigned_t                           callbacks;     // Rendered buffers.
+            unsigned_t                           skipped;       // Callbacks that returned without rendering.
+            unsigned_t                           overruns;      // Renders longer than the period.
+            unsigned_t                           missed;        // Periods with no callback at all.
+            double                               period_ns;
+            double                               last_ns;       // Render time of the last callback.
+            double                               mean_ns;
+            double                               max_ns;
+            std::array<unsigned_t, bucket_count> histogram;
+
+            // Unused share of the period, in percent:
+            double headroom     () const { return this->period_ns > 0 ? 100 * (1 - this->last_ns / this->period_ns) : 0; }
+            double min_headroom () const { return this->period_ns > 0 ? 100 * (1 - this->max_ns  / this->period_ns) : 0; }
+        };
+
+        // Set before the callbacks start, e.g. buffer size / sample rate.
+        void set_period (double seconds) {
+            this->period_ns_.store(seconds * 1e9, std::memory_order_relaxed);
+            this->started_ = false;
+        }
+
+        // Called by the audio thread when a callback starts rendering. Returns the start time for end().
+        clock::time_point begin () {
+            auto now = clock::now();
+            if (this->reset_requested_.exchange(false, std::memory_order_acquire))
+                this->clear();
+            auto period = this->period_ns_.load(std::memory_order_relaxed);
+            if (this->started_ && period > 0) {
+                // Callbacks arrive once per period, a longer gap means some never came:
+                auto gap     = std::chrono::duration<double, std::nano>(now - this->previous_).count();
+                auto periods = static_cast<unsigned_t>(gap / period + 0.5);
+                if (periods > 1)
+                    increment(this->missed_, periods - 1);
+            }
+            this->previous_ = now;
+            this->started_  = true;
+            return now;
+        }
+
+        // Called by the audio thread when the buffer is complete.
+        void end (clock::time_point start) {
+            auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            auto period  = this->period_ns_.load(std::memory_order_relaxed);
+            auto count   = this->callbacks_.load(std::memory_order_relaxed) + 1;
+
+            this->last_ns_.store(elapsed, std::memory_order_relaxed);
+            this->total_ns_.store(this->total_ns_.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+            if (elapsed > this->max_ns_.load(std::memory_order_relaxed))
+                this->max_ns_.store(elapsed, std::memory_order_relaxed);
+            if (period > 0) {
+                if (elapsed > period)
+                    increment(this->overruns_);
+                auto bucket = static_cast<std::size_t>(elapsed / period * 10);
+                increment(this->histogram_[std::min(bucket, bucket_count - 1)]);
+            }
+            this->callbacks_.store(count, std::memory_order_release);
+        }
+
+        // Called by the audio thread instead of begin() and end(), when a callback has to give up.
+        void skip () {
+            increment(this->skipped_);
+            this->previous_ = clock::now();
+        }
+
+        statistics read () const {
+            statistics result;
+            result.callbacks = this->callbacks_.load(std::memory_order_acquire);
+            result.skipped   = this->skipped_  .load(std::memory_order_relaxed);
+            result.overruns  = this->overruns_ .load(std::memory_order_relaxed);
+            result.missed    = this->missed_   .load(std::memory_order_relaxed);
+            result.period_ns = this->period_ns_.load(std::memory_order_relaxed);
+            result.last_ns   = this->last_ns_  .load(std::memory_order_relaxed);
+            result.max_ns    = this->max_ns_   .load(std::memory_order_relaxed);
+            result.mean_ns   = result.callbacks ? this->total_ns_.load(std::memory_order_relaxed) / result.callbacks : 0;
+            for (std::size_t i = 0; i < bucket_count; ++i)
+                result.histogram[i] = this->histogram_[i].load(std::memory_order_relaxed);
+            return result;
+        }
+
+        // The counters are cleared by the audio thread at the start of its next callback.
+        void reset () {
+            this->reset_requested_.store(true, std::memory_order_release);
+        }
+
+    private:
+        // Single writer, so no read-modify-write is needed:
+        static void increment (std::atomic<unsigned_t>& counter, unsigned_t n = 1) {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        void clear () {
+            for (auto counter: {&this->callbacks_, &this->skipped_, &this->overruns_, &this->missed_})
+                counter->store(0, std::memory_order_relaxed);
+            for (auto value: {&this->last_ns_, &this->total_ns_, &this->max_ns_})
+                value->store(0, std::memory_order_relaxed);
+            for (auto& bucket: this->histogram_)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+
+        std::atomic<double>                                period_ns_       {0};
+        std::atomic<unsigned_t>                            callbacks_       {0};
+        std::atomic<unsigned_t>                            skipped_         {0};
+        std::atomic<unsigned_t>                            overruns_        {0};
+        std::atomic<unsigned_t>                            missed_          {0};
+        std::atomic<double>                                last_ns_         {0};
+        std::atomic<double>                                total_ns_        {0};
+        std::atomic<double>                                max_ns_          {0};
+        std::array<std::atomic<unsigned_t>, bucket_count>  histogram_       {};
+        std::atomic<bool>                                  reset_requested_ {false};
+
+        // Audio thread only:
+        clock::time_point previous_;
+        bool              started_ = false;
+    };
+
+}
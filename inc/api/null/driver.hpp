@@ -0,0 +1,125 @@
+#pragma once
+
+#include "config.hpp"
+#include "api/monitor.hpp"
+#include "api/events.hpp"
+#include "functional.hpp"
+#include "compiled_function.hpp"
+#include "paralleltools.hpp"
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+/*
+
+Headless backend: No audio device, the blocks are rendered by a clock of our own.
+The SIMULATED clock renders the next block as soon as the previous one is done (offline rendering),
+the REAL_TIME clock paces the blocks at the buffer period, like a sound card would.
+The rendered blocks are passed to the output callback, if there is one, and dropped otherwise.
+
+*/
+
+namespace cynth::api::null {
+    struct driver {
+    public:
+        enum clock_enum { SIMULATED, REAL_TIME };
+
+        // Receives each rendered block (one channel), on the rendering thread.
+        using output_t = std::function<void (const floating_t* block, std::size_t size)>;
+
+        // Set before run():
+        inline static unsigned_t buffer_size = 512;
+        inline static floating_t sample_rate = wave_function::sample_rate;
+        inline static output_t   output;
+
+        inline static parallel_tools::rcu_slot<compiled_function<floating_t>> program;
+        inline static std::vector<floating_t> render_buffer;
+        inline static std::atomic<unsigned_t> sample_position; // First sample of the next block.
+        inline static callback_monitor        monitor;
+        inline static event_queue             events {event_capacity};
+        inline static std::atomic<bool>       stop_requested {false};
+
+        static void init () {
+            wave_function::sample_rate   = driver::sample_rate;
+            wave_function::sample_length = 1 / driver::sample_rate;
+            driver::render_buffer.resize(driver::buffer_size);
+            // Before the clock starts, a program set earlier follows the new sample rate:
+            if (auto current = driver::program.read())
+                current->resample();
+            driver::program.done();
+            driver::sample_position = 0;
+            driver::monitor.set_period(driver::buffer_size / driver::sample_rate);
+            driver::monitor.reset();
+            driver::stop_requested = false;
+        }
+
+        // Renders blocks on the calling thread until stopped, or until block_count blocks are done if it is not zero.
+        static void run (clock_enum clock, std::size_t block_count = 0) {
+            driver::init();
+            driver::loop(clock, block_count);
+        }
+
+        // run() without the initialization.
+        static void loop (clock_enum clock, std::size_t block_count = 0) {
+            using clock_t = std::chrono::steady_clock;
+            auto period = std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>{driver::buffer_size / driver::sample_rate});
+            auto next   = clock_t::now();
+            // The rendering thread reads the program, claim its hazard record before the first block:
+            parallel_tools::hazards::attach();
+
+            for (std::size_t i = 0; (!block_count || i < block_count) && !driver::stop_requested.load(std::memory_order_acquire); ++i) {
+                driver::buffer_switch();
+                if (clock == REAL_TIME) {
+                    next += period;
+                    // A late block is not made up for, the periods it took are lost like on a device:
+                    auto now = clock_t::now();
+                    if (next < now)
+                        next = now;
+                    std::this_thread::sleep_until(next);
+                }
+            }
+        }
+
+        static void request_stop () {
+            driver::stop_requested.store(true, std::memory_order_release);
+        }
+
+        // The graph is compiled on the calling thread and published to the clock thread, which picks it up
+        // at its next block without ever waiting. The previous program is destroyed here.
+        // The graph must outlive its use by the driver.
+        // With a worker pool, the blocks are rendered by all of its threads.
+        static void set_input (const wave_function& input, parallel_tools::worker_pool* pool = nullptr) {
+            driver::program.publish(std::make_unique<compiled_function<floating_t>>(input, 1, 0, pool));
+        }
+
+        // One period of the clock: The counterpart of buffer_switch_time_info in the ASIO driver.
+        static void buffer_switch () {
+            auto start = driver::monitor.begin();
+
+            auto buffer_size = driver::buffer_size;
+            auto block       = driver::render_buffer.data();
+            auto position    = driver::sample_position.load(std::memory_order_relaxed);
+
+            auto program = driver::program.read();
+            render_events(driver::events, position, buffer_size, [&] (std::size_t offset, std::size_t count) {
+                if (program)
+                    program->render((position + offset) / driver::sample_rate, 1 / driver::sample_rate, block + offset, count);
+                else
+                    std::fill(block + offset, block + offset + count, floating_t{0});
+            });
+            driver::program.done();
+            driver::sample_position.store(position + buffer_size, std::memory_order_relaxed);
+
+            if (driver::output)
+                driver::output(block, buffer_size);
+
+            driver::monitor.end(start);
+        }
+    };
+}
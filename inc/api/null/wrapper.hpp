@@ -0,0 +1,41 @@
+#pragma once
+
+#include "config.hpp"
+#include "api/null/driver.hpp"
+
+#include <cstddef>
+#include <cmath>
+#include <thread>
+
+namespace cynth::api::null {
+
+    // Runs the driver clock on its own thread for the lifetime of the wrapper.
+    class wrapper {
+    public:
+        // Zero seconds render until the wrapper is destroyed.
+        wrapper (driver::clock_enum clock = driver::REAL_TIME, floating_t seconds = 0) {
+            std::size_t block_count = static_cast<std::size_t>(std::ceil(seconds * driver::sample_rate / driver::buffer_size));
+            // Initialized here, so that a stop requested right away is not undone by the thread:
+            driver::init();
+            this->thread_ = std::thread{driver::loop, clock, block_count};
+        }
+
+        wrapper (const wrapper&) = delete;
+        wrapper& operator = (const wrapper&) = delete;
+
+        ~wrapper () {
+            driver::request_stop();
+            this->wait();
+        }
+
+        // Blocks until the requested duration is rendered (or the driver is stopped).
+        void wait () {
+            if (this->thread_.joinable())
+                this->thread_.join();
+        }
+
+    private:
+        std::thread thread_;
+    };
+
+}
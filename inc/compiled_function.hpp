@@ -0,0 +1,996 @@
+#pragma once
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "functional.hpp"
+#include "simdtools.hpp"
+#include "containertools.hpp"
+#include "convolution.hpp"
+#include "paralleltools.hpp"
+#include "profiling.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <string>
+#include <ostream>
+
+namespace cynth {
+
+    // A composite_function graph lowered into a flat list of instructions.
+    // Every instruction operates on whole blocks of samples stored in registers.
+    // The node order is resolved once during compilation, so the evaluation
+    // no longer branches on identities/constants and never follows child pointers.
+    // Nodes that cannot be flattened (caches, convolutions) are still referenced,
+    // so the source graph must outlive the compiled function.
+    // The graph is treated as a DAG: A node referenced from several parents (or an equal
+    // subexpression built twice) is lowered only once per input and its register is reused.
+    // A convolution of a signal evaluated at the stream of input times is run as a streaming FIR filter:
+    // The kernel is sampled once here and the signal is evaluated only once per output sample.
+    // When the input times jump (e.g. after a driver reset), the history is refilled by direct evaluation.
+    // The kernel taps are sample_length apart, so a render at any other step evaluates the convolution
+    // directly instead (like OP_CONV). After a change of the sample rate, resample() samples the kernels again.
+    // Kernels of at least fft_threshold taps are split into partitions of fft_partition taps
+    // and all but the first one are applied in the frequency domain (see partitioned_convolver).
+    // When the graph is compiled, it is also simplified: Constant subtrees are folded,
+    // neutral elements (x+0, x*1, ...) are removed, chains of constant additions/multiplications
+    // are reassociated into one instruction and unused instructions are dropped.
+    // The final program is stored as parallel arrays: A tag byte and three 32-bit register indices
+    // per instruction, plus an index into a side table for the few that reference a function,
+    // node or filter. Registers are reused once their last reader has run, so the working set
+    // stays small even for large graphs.
+    // While rendering, every register carries a fact about its current block in each lane: varying, uniform
+    // (all samples equal) or zero. Additions and multiplications use them to skip work:
+    // x * 0 and x + 0 are not computed, functions of a uniform block are evaluated once.
+    // When the first operand of a multiplication is zero, the instructions computing only
+    // its second operand are skipped as well (e.g. the wave of an oscillator with zero amplitude),
+    // lane by lane, so a silent voice costs (almost) nothing even when the others play.
+    // Skipped FIR filters and phase accumulators resynchronize when they run again.
+    // A program may also evaluate several instances (lanes) of the graph at once, e.g. the voices
+    // of a polyphonic device: Every register then holds the current block of each lane back to back,
+    // so an arithmetic instruction runs as one vector loop across all the lanes, unless some of them are skipped
+    // or carry a zero or uniform block (then it runs lane by lane). The lanes differ
+    // by their input times and their parameters (parameter nodes read the value of lane l at
+    // value + l * lane_stride). FIR filters keep a history per lane, which starts silent.
+    // Function sources are called per lane, but share their state, so they should be stateless.
+    // Given a worker_pool, the program is split into tasks run in parallel: Independent branches
+    // (e.g. the operands of a sum of oscillators) become separate tasks, unless they are cheaper
+    // than parallel_grain. Registers are not reused then, so that the tasks never share one.
+    // Control-rate nodes are evaluated by the node itself at a few points per block of each lane
+    // (see composite_function::set_control_rate), parameters inside them read the value of the first lane.
+    template <typename T>
+    class compiled_function {
+    public:
+        using function_t = composite_function<T>;
+        using func_ptr_t = typename function_t::func_ptr_t;
+        using block_t    = typename function_t::block_t;
+
+        inline constexpr static std::size_t block_size     = function_t::block_size;
+        inline constexpr static std::size_t input_register = 0;
+        inline constexpr static std::size_t no_register    = static_cast<std::size_t>(-1);
+        inline constexpr static std::size_t fft_threshold  = 256;
+        inline constexpr static std::size_t fft_partition  = 64;
+        inline constexpr static std::size_t parallel_grain = 64; // Minimum estimated cost of a task (see cost()).
+
+        enum opcode_enum: std::uint8_t { OP_ADD, OP_SUB, OP_MULT, OP_DIV, OP_CALL, OP_SOURCE, OP_PARAM, OP_CACHE, OP_CONV, OP_FIR, OP_CONTROL };
+
+        using index_t = std::uint32_t;
+
+        // Per-block facts about the values in a register:
+        enum fact_enum: std::uint8_t { VARYING, UNIFORM, ZERO };
+
+        // Unpacked form of an instruction, used during compilation and reported by program().
+        struct instruction {
+            opcode_enum       opcode;
+            std::size_t       out;
+            std::size_t       first;
+            std::size_t       second;
+            func_ptr_t        func;   // OP_CALL
+            const function_t* node;   // OP_SOURCE, OP_PARAM, OP_CACHE, OP_CONV, OP_FIR, OP_CONTROL
+            std::size_t       state;  // OP_FIR
+        };
+
+        // Silence by default:
+        compiled_function (): compiled_function{function_t{T{0}}} {}
+
+        compiled_function (const function_t& root, std::size_t lanes = 1, std::size_t lane_stride = 0, parallel_tools::worker_pool* pool = nullptr):
+            lanes_       {std::max<std::size_t>(1, lanes)},
+            lane_stride_ {lane_stride},
+            lane_times_  (this->lanes_, 0),
+            pool_        {pool} {
+
+            this->result_ = this->lower(root, input_register);
+            this->eliminate_dead_code();
+            this->pack();
+            // Every lane has its own filter history:
+            std::vector<fir_state> firs;
+            for (auto& fir: this->firs_)
+                firs.insert(firs.end(), this->lanes_, fir);
+            this->firs_ = std::move(firs);
+            if (this->pool_)
+                this->partition();
+            auto tasks = std::max<std::size_t>(1, this->tasks_.size());
+            this->lane_skips_.assign(tasks * this->lanes_, 0);
+            this->executed_.assign(tasks, 0);
+        }
+
+        std::size_t lanes () const { return this->lanes_; }
+        std::size_t tasks () const { return this->tasks_.size(); }
+
+        std::size_t instruction_count () const { return this->opcodes_.size(); }
+        std::size_t register_count    () const { return this->facts_.size() / this->lanes_; }
+        std::size_t shared_count      () const { return this->shared_count_; }  // Evaluations saved by reusing shared subexpressions.
+        std::size_t removed_count     () const { return this->removed_count_; } // Operations removed by the simplification.
+
+        // Instructions executed so far, counted once per lane and block (skipped ones are not counted).
+        unsigned_t executed_count () const {
+            unsigned_t result = 0;
+            for (auto count: this->executed_)
+                result += count;
+            return result;
+        }
+
+        std::vector<instruction> program () const {
+            std::vector<instruction> result;
+            for (std::size_t i = 0; i < this->opcodes_.size(); ++i) {
+                instruction ins{static_cast<opcode_enum>(this->opcodes_[i]), this->outs_[i], this->firsts_[i], this->seconds_[i], nullptr, nullptr, 0};
+                switch (ins.opcode) {
+                case OP_CALL:
+                    ins.func = this->funcs_[this->payloads_[i]];
+                    break;
+                case OP_SOURCE: case OP_PARAM: case OP_CACHE: case OP_CONV: case OP_CONTROL:
+                    ins.node = this->nodes_[this->payloads_[i]];
+                    break;
+                case OP_FIR:
+                    ins.node  = this->firs_[this->payloads_[i] * this->lanes_].node;
+                    ins.state = this->payloads_[i];
+                    break;
+                default:
+                    break;
+                }
+                result.push_back(ins);
+            }
+            return result;
+        }
+
+        #ifdef CYNTH_PROFILE
+        // Prints the instructions ranked by the cycles spent in them.
+        // Nodes evaluated by an instruction (caches, convolutions, ...) also record their own profile.
+        void profile_report (std::ostream& out) const {
+            static const char* names[] = {"ADD", "SUB", "MULT", "DIV", "CALL", "SOURCE", "PARAM", "CACHE", "CONV", "FIR", "CONTROL"};
+            std::vector<profiling::report_row> rows;
+            for (std::size_t i = 0; i < this->opcodes_.size(); ++i) {
+                auto description = std::string{names[this->opcodes_[i]]}
+                    + " r" + std::to_string(this->outs_[i])
+                    + " r" + std::to_string(this->firsts_[i])
+                    + " r" + std::to_string(this->seconds_[i]);
+                auto& p = this->profiles_[i];
+                rows.push_back({i, description, p.evaluations.get(), p.samples.get(), p.self_cycles.get(), p.self_cycles.get(), 0, 0, 0});
+            }
+            profiling::print_report(std::move(rows), out);
+        }
+
+        void reset_profile () {
+            for (auto& p: this->profiles_)
+                p.reset();
+        }
+        #endif
+
+        // out[i] = root(t0 + i * dt) for i in [0, n)
+        // With several lanes, all of them start at t0 and their results are summed.
+        void render (T t0, T dt, T* out, std::size_t n) {
+            std::fill(this->lane_times_.begin(), this->lane_times_.end(), t0);
+            for (std::size_t offset = 0; offset < n; offset += block_size) {
+                std::size_t count  = std::min(block_size, n - offset);
+                auto        result = this->run(offset, dt, count);
+                std::copy(result, result + count, out + offset);
+                for (std::size_t lane = 1; lane < this->lanes_; ++lane)
+                    simd_tools::add(out + offset, result + lane * count, out + offset, count);
+            }
+        }
+
+        // out[lane * n + i] = root(t0[lane] + i * dt) in lane `lane`, for i in [0, n)
+        // Only the lanes with active[lane] set are computed (all without the mask), the others are left as they are.
+        void render_lanes (const T* t0, T dt, T* out, std::size_t n, const bool* active = nullptr) {
+            std::copy(t0, t0 + this->lanes_, this->lane_times_.begin());
+            this->lane_active_ = active;
+            for (std::size_t offset = 0; offset < n; offset += block_size) {
+                std::size_t count  = std::min(block_size, n - offset);
+                auto        result = this->run(offset, dt, count);
+                for (std::size_t lane = 0; lane < this->lanes_; ++lane)
+                    if (!active || active[lane])
+                        std::copy(result + lane * count, result + (lane + 1) * count, out + lane * n + offset);
+            }
+            this->lane_active_ = nullptr;
+        }
+
+        // Samples the FIR kernels again at the current sample_length, after a change of the sample rate.
+        // Allocates, so it's meant for when the program is not rendering (e.g. while a driver is initialized).
+        void resample () {
+            for (auto& fir: this->firs_)
+                if (fir.step != static_cast<T>(function_t::sample_length))
+                    fir = sample_fir(*fir.node);
+        }
+
+    private:
+        // Runs the program on one block of `count` samples starting `offset` samples after lane_times_.
+        // Within a block, lane l of a register starts at l * count. Returns the result register.
+        const T* run (std::size_t offset, T dt, std::size_t count) {
+            auto time = this->reg(input_register);
+            for (std::size_t lane = 0; lane < this->lanes_; ++lane)
+                for (std::size_t i = 0; i < count; ++i)
+                    time[lane * count + i] = this->lane_times_[lane] + static_cast<T>(offset + i) * dt;
+            this->block_step_ = dt;
+            if (this->tasks_.size() > 1) {
+                auto task = [this, count] (std::size_t t) { this->run_range(this->task_begins_[t], this->task_begins_[t + 1], count, t); };
+                this->pool_->run(this->tasks_, task);
+            } else {
+                this->run_range(0, this->opcodes_.size(), count, 0);
+            }
+            return this->reg(this->result_);
+        }
+
+        // Lane l skips the instructions before skips[l] (see guard()), inactive lanes skip all of them.
+        void run_range (std::size_t begin, std::size_t end, std::size_t count, std::size_t task) {
+            auto       lanes    = this->lanes_;
+            auto       skips    = this->lane_skips_.data() + task * lanes;
+            unsigned_t executed = 0;
+            for (std::size_t lane = 0; lane < lanes; ++lane)
+                skips[lane] = !this->lane_active_ || this->lane_active_[lane] ? begin : end;
+            for (std::size_t i = begin; i < end; ++i) {
+                this->guard(i, skips);
+                std::size_t active = 0;
+                std::size_t next   = end;
+                for (std::size_t lane = 0; lane < lanes; ++lane) {
+                    if (skips[lane] <= i)
+                        ++active;
+                    else
+                        next = std::min(next, skips[lane]);
+                }
+                if (!active) {
+                    i = next - 1;
+                    continue;
+                }
+                CYNTH_PROFILE_COUNT(this->profiles_[i].evaluations, 1);
+                CYNTH_PROFILE_COUNT(this->profiles_[i].samples, count * active);
+                CYNTH_PROFILE_TIMER(this->profiles_[i].self_cycles);
+                if (active < lanes || !this->execute_wide(i, count))
+                    for (std::size_t lane = 0; lane < lanes; ++lane)
+                        if (skips[lane] <= i)
+                            this->execute(i, count, lane);
+                executed += active;
+            }
+            this->executed_[task] += executed;
+        }
+
+        fact_enum& fact (std::size_t reg, std::size_t lane) { return this->facts_[reg * this->lanes_ + lane]; }
+
+        T* reg (std::size_t i) { return this->registers_.data() + i * this->lanes_ * block_size; }
+
+        // During compilation, every value gets its own virtual register.
+        // They are mapped onto the physical ones by pack().
+        std::size_t allocate () {
+            return this->virtual_count_++;
+        }
+
+        // Constants are pooled by their bit pattern: NaN has no order among floats, and -0 must stay apart from 0.
+        std::size_t constant (T value) {
+            constant_key key;
+            std::memcpy(&key, &value, sizeof(T));
+            auto found = this->constants_.find(key);
+            if (found != this->constants_.end())
+                return found->second;
+            auto reg = this->allocate();
+            this->constants_.emplace(key, reg);
+            this->constant_values_.emplace(reg, value);
+            return reg;
+        }
+
+        bool constant_value (std::size_t reg, T& value) const {
+            auto found = this->constant_values_.find(reg);
+            if (found == this->constant_values_.end())
+                return false;
+            value = found->second;
+            return true;
+        }
+
+        static T apply (opcode_enum opcode, T first, T second) {
+            switch (opcode) {
+            case OP_ADD:  return first + second;
+            case OP_SUB:  return first - second;
+            case OP_MULT: return first * second;
+            case OP_DIV:  default:
+                return first / second;
+            }
+        }
+
+        // Algebraic simplification of a single instruction before it's emitted.
+        // Returns the register holding the result, when no instruction is needed,
+        // otherwise the operands may be rewritten and no_register is returned.
+        std::size_t simplify (opcode_enum& opcode, std::size_t& first, std::size_t& second, func_ptr_t func) {
+            T a = 0, b = 0;
+            bool first_constant  = this->constant_value(first,  a);
+            bool second_constant = this->constant_value(second, b);
+
+            if (opcode == OP_CALL)
+                // function_wrapper cannot capture anything, so it's a pure function:
+                return first_constant ? this->constant((*func)(a)) : no_register;
+            if (opcode != OP_ADD && opcode != OP_SUB && opcode != OP_MULT && opcode != OP_DIV)
+                return no_register;
+
+            if (first_constant && second_constant)
+                return this->constant(apply(opcode, a, b));
+
+            // x - c = x + (-c), x / c = x * (1/c)
+            if (opcode == OP_SUB && second_constant) {
+                opcode = OP_ADD;
+                second = this->constant(b = -b);
+            }
+            if (opcode == OP_DIV && second_constant && b != 0) {
+                opcode = OP_MULT;
+                second = this->constant(b = 1 / b);
+            }
+            // The constant operand of commutative operations goes second:
+            if ((opcode == OP_ADD || opcode == OP_MULT) && first_constant) {
+                std::swap(first, second);
+                std::swap(a, b);
+                std::swap(first_constant, second_constant);
+            }
+            if (!second_constant)
+                return no_register;
+
+            // Neutral and absorbing elements:
+            if (opcode == OP_ADD  && b == 0)
+                return first;
+            if (opcode == OP_MULT && b == 1)
+                return first;
+            if (opcode == OP_MULT && b == 0)
+                return this->constant(0);
+
+            // (x + c1) + c2 = x + (c1 + c2), (x * c1) * c2 = x * (c1 * c2)
+            // emit() orders the operands of the inner instruction by register, so its constant may be either one.
+            // The inner instruction is left for the dead code elimination.
+            auto producer = this->producers_.find(first);
+            if (producer != this->producers_.end()) {
+                auto& inner = this->program_[producer->second];
+                T c;
+                if (inner.opcode == opcode && (this->constant_value(inner.second, c) || this->constant_value(inner.first, c))) {
+                    first  = this->constant_value(inner.second, c) ? inner.first : inner.second;
+                    second = this->constant(apply(opcode, c, b));
+                    return this->simplify(opcode, first, second, func);
+                }
+            }
+            return no_register;
+        }
+
+        void eliminate_dead_code () {
+            std::vector<bool> live(this->virtual_count_, false);
+            live[this->result_] = true;
+            for (auto ins = this->program_.rbegin(); ins != this->program_.rend(); ++ins) {
+                if (!live[ins->out])
+                    continue;
+                live[ins->first]  = true;
+                live[ins->second] = true;
+            }
+            auto dead = std::remove_if(this->program_.begin(), this->program_.end(), [&] (const instruction& ins) { return !live[ins.out]; });
+            this->removed_count_ += this->program_.end() - dead;
+            this->program_.erase(dead, this->program_.end());
+            this->producers_.clear();
+        }
+
+        // Assigns physical registers and stores the program as parallel arrays.
+        // The input and the constants keep their registers for the whole block (constants are written
+        // only once, here). Any other register is released after its last reader and reused by a later
+        // instruction (unless the program runs in parallel). Elementwise instructions may write into a register they read,
+        // FIR filters read their input after writing some outputs, so they may not.
+        void pack () {
+            if (this->virtual_count_ > std::numeric_limits<index_t>::max())
+                throw cynth_exception{"Too many registers in a compiled function."};
+
+            auto unassigned = std::numeric_limits<index_t>::max();
+            std::vector<index_t>     physical (this->virtual_count_, unassigned);
+            std::vector<std::size_t> last_use (this->virtual_count_, 0);
+            std::vector<bool>        produced (this->virtual_count_, false);
+            for (std::size_t i = 0; i < this->program_.size(); ++i) {
+                last_use[this->program_[i].first]  = i;
+                last_use[this->program_[i].second] = i;
+                produced[this->program_[i].out]    = true;
+            }
+
+            index_t count = 0;
+            physical[input_register] = count++;
+            std::vector<std::pair<index_t, T>> constants;
+            auto pin = [&] (std::size_t reg) {
+                T value;
+                if (physical[reg] == unassigned && this->constant_value(reg, value)) {
+                    physical[reg] = count++;
+                    constants.emplace_back(physical[reg], value);
+                }
+            };
+            pin(this->result_);
+            for (auto& ins: this->program_) {
+                pin(ins.first);
+                pin(ins.second);
+            }
+
+            std::vector<index_t> free;
+            auto release = [&] (std::size_t reg, std::size_t i) {
+                if (!this->pool_ && produced[reg] && reg != this->result_ && last_use[reg] == i)
+                    free.push_back(physical[reg]);
+            };
+            for (std::size_t i = 0; i < this->program_.size(); ++i) {
+                auto& ins = this->program_[i];
+                bool elementwise = ins.opcode != OP_FIR;
+                if (elementwise) {
+                    release(ins.first, i);
+                    if (ins.second != ins.first)
+                        release(ins.second, i);
+                }
+                if (free.empty()) {
+                    physical[ins.out] = count++;
+                } else {
+                    physical[ins.out] = free.back();
+                    free.pop_back();
+                }
+                if (!elementwise)
+                    release(ins.first, i);
+
+                this->opcodes_.push_back(ins.opcode);
+                this->outs_   .push_back(physical[ins.out]);
+                this->firsts_ .push_back(physical[ins.first]);
+                this->seconds_.push_back(physical[ins.second]);
+                switch (ins.opcode) {
+                case OP_CALL:
+                    this->payloads_.push_back(static_cast<index_t>(this->funcs_.size()));
+                    this->funcs_.push_back(ins.func);
+                    break;
+                case OP_SOURCE: case OP_PARAM: case OP_CACHE: case OP_CONV: case OP_CONTROL:
+                    this->payloads_.push_back(static_cast<index_t>(this->nodes_.size()));
+                    this->nodes_.push_back(ins.node);
+                    break;
+                case OP_FIR:
+                    this->payloads_.push_back(static_cast<index_t>(ins.state));
+                    break;
+                default:
+                    this->payloads_.push_back(0);
+                    break;
+                }
+            }
+
+            this->pack_guards(physical);
+            #ifdef CYNTH_PROFILE
+            this->profiles_.resize(this->opcodes_.size());
+            #endif
+
+            this->result_ = physical[this->result_];
+            this->registers_.assign(count * this->lanes_ * block_size, T{0});
+            this->facts_.assign(count * this->lanes_, VARYING);
+            for (auto [reg, value]: constants) {
+                std::fill(this->reg(reg), this->reg(reg) + this->lanes_ * block_size, value);
+                for (std::size_t lane = 0; lane < this->lanes_; ++lane)
+                    this->fact(reg, lane) = value == 0 ? ZERO : UNIFORM;
+            }
+
+            this->program_.clear();
+            this->guard_candidates_.clear();
+            this->lowered_.clear();
+            this->values_.clear();
+            this->constants_.clear();
+            this->constant_values_.clear();
+        }
+
+        // Value numbering: An instruction equal to an already emitted one is not emitted again.
+        std::size_t emit (opcode_enum opcode, std::size_t first, std::size_t second, func_ptr_t func = nullptr, const function_t* node = nullptr, std::size_t state = 0) {
+            auto simplified = this->simplify(opcode, first, second, func);
+            if (simplified != no_register) {
+                ++this->removed_count_;
+                return simplified;
+            }
+            if ((opcode == OP_ADD || opcode == OP_MULT) && first > second)
+                std::swap(first, second);
+            value_key key{opcode, first, second, reinterpret_cast<std::uintptr_t>(func), node};
+            auto found = this->values_.find(key);
+            if (found != this->values_.end()) {
+                ++this->shared_count_;
+                return found->second;
+            }
+            auto out = this->allocate();
+            this->producers_.emplace(out, this->program_.size());
+            this->program_.push_back({opcode, out, first, second, func, node, state});
+            this->values_.emplace(key, out);
+            return out;
+        }
+
+        // Returns the register holding the node's values when evaluated at the values in register `in`.
+        std::size_t lower (const function_t& node, std::size_t in) {
+            auto key   = std::make_pair(&node, in);
+            auto found = this->lowered_.find(key);
+            if (found != this->lowered_.end()) {
+                ++this->shared_count_;
+                return found->second;
+            }
+            auto reg = this->lower_node(node, in);
+            this->lowered_.emplace(key, reg);
+            return reg;
+        }
+
+        std::size_t lower_binary (opcode_enum opcode, const function_t& node, std::size_t in) {
+            auto first  = this->lower_first(node, in);
+            auto begin  = this->program_.size();
+            auto second = this->lower_second(node, in);
+            auto end    = this->program_.size();
+            auto out    = this->emit(opcode, first, second);
+            // Candidate for skipping the second operand when the first one is zero, validated by pack():
+            if (opcode == OP_MULT && begin < end && this->program_.size() == end + 1 && this->program_.back().out == out) {
+                guard_candidate candidate{first, second, out, {}};
+                for (auto i = begin; i < end; ++i)
+                    candidate.cone.push_back(this->program_[i].out);
+                this->guard_candidates_.push_back(std::move(candidate));
+            }
+            return out;
+        }
+
+        std::size_t lower_node (const function_t& node, std::size_t in) {
+            if (node.cache_ptr_)
+                return this->emit(OP_CACHE, in, in, nullptr, &node);
+            if (node.control_rate_ > 1)
+                return this->emit(OP_CONTROL, in, in, nullptr, &node);
+            if (node.func_ptr_)
+                return this->emit(OP_CALL, in, in, node.func_ptr_);
+            if (node.source_ptr_)
+                return this->emit(OP_SOURCE, in, in, nullptr, &node);
+            if (node.param_ptr_)
+                return this->emit(OP_PARAM, in, in, nullptr, &node);
+            switch (node.operation_) {
+            case CONSTANT: default:
+                return this->lower_first(node, in);
+            case ADD:
+                return this->lower_binary(OP_ADD,  node, in);
+            case SUB:
+                return this->lower_binary(OP_SUB,  node, in);
+            case MULT:
+                return this->lower_binary(OP_MULT, node, in);
+            case DIV:
+                return this->lower_binary(OP_DIV,  node, in);
+            case COMP:
+                // The inner function's result becomes the input of the outer one.
+                return this->lower_first(node, this->lower_second(node, in));
+            case CONV:
+                if (in == input_register)
+                    return this->lower_fir(node, in);
+                return this->emit(OP_CONV, in, in, nullptr, &node);
+            }
+        }
+
+        std::size_t lower_fir (const function_t& node, std::size_t in) {
+            auto signal = this->lower_second(node, in);
+            auto out    = this->emit(OP_FIR, signal, signal, nullptr, &node, this->firs_.size());
+            if (this->program_.back().out == out && this->program_.back().state == this->firs_.size())
+                this->firs_.push_back(sample_fir(node));
+            return out;
+        }
+
+        // A guard lets the second operand of a multiplication be skipped. That is only possible,
+        // when the instructions computing it form a contiguous range right before the multiplication
+        // and nothing else reads their results.
+        void pack_guards (const std::vector<index_t>& physical) {
+            std::map<std::size_t, std::size_t> index; // Virtual output register -> instruction.
+            std::map<std::size_t, std::size_t> reads; // Virtual register -> number of reading instructions.
+            for (std::size_t i = 0; i < this->program_.size(); ++i) {
+                auto& ins = this->program_[i];
+                index[ins.out] = i;
+                ++reads[ins.first];
+                if (ins.second != ins.first)
+                    ++reads[ins.second];
+            }
+
+            std::vector<skip_guard> guards;
+            for (auto& candidate: this->guard_candidates_) {
+                auto mult = index.find(candidate.out);
+                if (mult == index.end())
+                    continue;
+                auto& ins = this->program_[mult->second];
+                if (ins.opcode != OP_MULT || !((ins.first == candidate.condition && ins.second == candidate.operand) || (ins.first == candidate.operand && ins.second == candidate.condition)) || candidate.condition == candidate.operand)
+                    continue;
+                std::vector<std::size_t> cone;
+                for (auto reg: candidate.cone) {
+                    auto found = index.find(reg);
+                    if (found != index.end())
+                        cone.push_back(found->second);
+                }
+                if (cone.empty())
+                    continue;
+                std::sort(cone.begin(), cone.end());
+                std::size_t begin = cone.front();
+                if (cone.back() + 1 != mult->second || cone.size() != mult->second - begin)
+                    continue;
+                // Readers of the cone outputs from within the cone and the multiplication:
+                std::map<std::size_t, std::size_t> inner;
+                for (auto i = begin; i <= mult->second; ++i) {
+                    auto& reader = this->program_[i];
+                    ++inner[reader.first];
+                    if (reader.second != reader.first)
+                        ++inner[reader.second];
+                }
+                bool exclusive = true;
+                for (auto i = begin; i < mult->second && exclusive; ++i) {
+                    auto reg = this->program_[i].out;
+                    exclusive = reg != this->result_ && reads[reg] == inner[reg];
+                }
+                if (exclusive)
+                    guards.push_back({physical[candidate.condition], static_cast<index_t>(begin), static_cast<index_t>(mult->second)});
+            }
+
+            // Outer guards first, when several start at the same instruction:
+            std::sort(guards.begin(), guards.end(), [] (const skip_guard& a, const skip_guard& b) {
+                return a.begin != b.begin ? a.begin < b.begin : a.target > b.target;
+            });
+            this->guards_ = guards;
+            this->index_guards(this->program_.size());
+        }
+
+        void index_guards (std::size_t count) {
+            this->guard_index_.assign(count + 1, 0);
+            for (auto& g: this->guards_)
+                ++this->guard_index_[g.begin + 1];
+            for (std::size_t i = 1; i < this->guard_index_.size(); ++i)
+                this->guard_index_[i] += this->guard_index_[i - 1];
+        }
+
+        // Rough cost of an instruction per sample and lane, in additions.
+        std::size_t cost (std::size_t i) const {
+            switch (static_cast<opcode_enum>(this->opcodes_[i])) {
+            case OP_CALL:    return 8;
+            case OP_SOURCE:  return 16;
+            case OP_CACHE:   return 4;
+            case OP_CONTROL: return 4;
+            case OP_CONV:    return function_t::filter_order;
+            case OP_FIR:     return 32;
+            default:         return 1;
+            }
+        }
+
+        // Splits the program into tasks of contiguous instructions. Data only flows forward in the program,
+        // so any such split is valid, the ranges are just chosen along the branches of the graph.
+        void partition () {
+            auto count = this->opcodes_.size();
+            std::vector<std::size_t> producer (this->register_count(), no_register);
+            std::vector<std::size_t> costs    (count + 1, 0);
+            for (std::size_t i = 0; i < count; ++i) {
+                producer[this->outs_[i]] = i;
+                costs[i + 1] = costs[i] + this->cost(i) * this->lanes_;
+            }
+            this->task_begins_.clear();
+            if (count)
+                this->split(0, count, producer, costs);
+            // Neighbouring tasks are merged until the pool can hold all of them:
+            while (this->task_begins_.size() > std::max<std::size_t>(1, this->pool_->capacity())) {
+                std::vector<index_t> merged;
+                for (std::size_t t = 0; t < this->task_begins_.size(); t += 2)
+                    merged.push_back(this->task_begins_[t]);
+                this->task_begins_ = std::move(merged);
+            }
+            auto tasks = this->task_begins_.size();
+            this->task_begins_.push_back(static_cast<index_t>(count));
+
+            // Dependencies on the tasks producing the operands. Function sources may carry state,
+            // so the tasks calling the same one run in program order.
+            std::vector<std::size_t>                         owner (this->register_count(), no_register);
+            std::map<const function_source<T>*, std::size_t> sources;
+            std::vector<std::vector<std::uint32_t>>          successors (tasks);
+            this->tasks_ = {};
+            for (std::size_t t = 0; t < tasks; ++t) {
+                std::vector<std::size_t> dependencies;
+                for (auto i = this->task_begins_[t]; i < this->task_begins_[t + 1]; ++i) {
+                    for (auto reg: {this->firsts_[i], this->seconds_[i]})
+                        if (owner[reg] != no_register && owner[reg] != t)
+                            dependencies.push_back(owner[reg]);
+                    if (this->opcodes_[i] == OP_SOURCE) {
+                        auto [found, inserted] = sources.emplace(this->nodes_[this->payloads_[i]]->source_ptr_, t);
+                        if (!inserted && found->second != t)
+                            dependencies.push_back(std::exchange(found->second, t));
+                    }
+                    owner[this->outs_[i]] = t;
+                }
+                std::sort(dependencies.begin(), dependencies.end());
+                dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+                for (auto d: dependencies)
+                    successors[d].push_back(static_cast<std::uint32_t>(t));
+                this->tasks_.dependencies.push_back(static_cast<std::uint32_t>(dependencies.size()));
+            }
+            this->tasks_.successor_begin.push_back(0);
+            for (auto& list: successors) {
+                this->tasks_.successors.insert(this->tasks_.successors.end(), list.begin(), list.end());
+                this->tasks_.successor_begin.push_back(static_cast<std::uint32_t>(this->tasks_.successors.size()));
+            }
+
+            // A skipped range must not leave its task:
+            auto task_of = [&] (std::size_t i) { return std::upper_bound(this->task_begins_.begin(), this->task_begins_.end(), i) - this->task_begins_.begin(); };
+            this->guards_.erase(std::remove_if(this->guards_.begin(), this->guards_.end(), [&] (const skip_guard& g) {
+                return task_of(g.begin) != task_of(g.target);
+            }), this->guards_.end());
+            this->index_guards(count);
+        }
+
+        // Appends the beginnings of the tasks covering [begin, end). The last instruction stays
+        // with the task of its latest operand, the earlier ones are split between its operands.
+        void split (std::size_t begin, std::size_t end, const std::vector<std::size_t>& producer, const std::vector<std::size_t>& costs) {
+            auto last  = end - 1;
+            auto local = [&] (index_t reg) {
+                auto p = producer[reg];
+                return p != no_register && p >= begin && p < last ? p : no_register;
+            };
+            auto first  = local(this->firsts_[last]);
+            auto second = local(this->seconds_[last]);
+            if (first == no_register)
+                std::swap(first, second);
+            if (first == no_register || costs[end] - costs[begin] < parallel_grain) {
+                this->task_begins_.push_back(static_cast<index_t>(begin));
+                return;
+            }
+            if (second == no_register || second == first)
+                return this->split(begin, first + 1, producer, costs);
+            auto [low, high] = std::minmax(first, second);
+            this->split(begin,   low + 1,  producer, costs);
+            this->split(low + 1, high + 1, producer, costs);
+        }
+
+        // The guards starting at instruction i skip the lanes where their condition is zero
+        // up to their multiplication. Outer guards come first, the inner ones only see the lanes left.
+        void guard (std::size_t i, std::size_t* skips) {
+            for (auto g = this->guard_index_[i]; g < this->guard_index_[i + 1]; ++g) {
+                auto& guard = this->guards_[g];
+                for (std::size_t lane = 0; lane < this->lanes_; ++lane)
+                    if (skips[lane] <= i && this->fact(guard.condition, lane) == ZERO)
+                        skips[lane] = guard.target;
+            }
+        }
+
+        std::size_t lower_first (const function_t& node, std::size_t in) {
+            if (node.first_ptr_)
+                return this->lower(*node.first_ptr_, in);
+            if (node.first_identity_)
+                return in;
+            return this->constant(node.first_constant_);
+        }
+        std::size_t lower_second (const function_t& node, std::size_t in) {
+            if (node.second_ptr_)
+                return this->lower(*node.second_ptr_, in);
+            if (node.second_identity_)
+                return in;
+            return this->constant(node.second_constant_);
+        }
+
+        struct fir_state {
+            partitioned_convolver<T> filter;
+            const function_t*        node;
+            T                        step;             // Spacing of the kernel taps (sample_length when sampled).
+            bool                     primed    = false;
+            T                        next_time = 0;
+        };
+
+        // The kernel of the convolution node sampled at the current sample_length.
+        static fir_state sample_fir (const function_t& node) {
+            std::vector<T> kernel(function_t::filter_order);
+            for (std::size_t i = 0; i < kernel.size(); ++i)
+                kernel[i] = node.first(function_t::floating_time(i));
+            return {partitioned_convolver<T>{kernel, kernel.size() >= fft_threshold ? fft_partition : kernel.size()}, &node, static_cast<T>(function_t::sample_length)};
+        }
+
+        // Arithmetic of instruction i on n samples in each of the lanes, as one loop across all of them.
+        // Only when every operand lane is varying, returns false otherwise.
+        bool execute_wide (std::size_t i, std::size_t n) {
+            auto opcode = static_cast<opcode_enum>(this->opcodes_[i]);
+            if (opcode != OP_ADD && opcode != OP_SUB && opcode != OP_MULT && opcode != OP_DIV)
+                return false;
+            auto lanes = this->lanes_;
+            auto first  = this->facts_.data() + this->firsts_[i]  * lanes;
+            auto second = this->facts_.data() + this->seconds_[i] * lanes;
+            for (std::size_t lane = 0; lane < lanes; ++lane)
+                if (first[lane] != VARYING || second[lane] != VARYING)
+                    return false;
+            auto total = lanes * n;
+            auto a     = this->reg(this->firsts_[i]);
+            auto b     = this->reg(this->seconds_[i]);
+            auto out   = this->reg(this->outs_[i]);
+            switch (opcode) {
+            case OP_ADD:  simd_tools::add (a, b, out, total); break;
+            case OP_SUB:  simd_tools::sub (a, b, out, total); break;
+            case OP_MULT: simd_tools::mult(a, b, out, total); break;
+            case OP_DIV:  default:
+                simd_tools::div(a, b, out, total); break;
+            }
+            std::fill(this->facts_.data() + this->outs_[i] * lanes, this->facts_.data() + (this->outs_[i] + 1) * lanes, VARYING);
+            return true;
+        }
+
+        // Instruction i on the n samples of one lane.
+        void execute (std::size_t i, std::size_t n, std::size_t lane) {
+            auto  offset     = lane * n;
+            auto  out_reg    = this->outs_[i];
+            auto  first_reg  = this->firsts_[i];
+            auto  second_reg = this->seconds_[i];
+            auto  out        = this->reg(out_reg)    + offset;
+            auto  first      = this->reg(first_reg)  + offset;
+            auto  second     = this->reg(second_reg) + offset;
+            auto  a          = this->fact(first_reg,  lane);
+            auto  b          = this->fact(second_reg, lane);
+            auto& fact       = this->fact(out_reg,    lane);
+            switch (static_cast<opcode_enum>(this->opcodes_[i])) {
+            case OP_ADD:
+                if (a == ZERO || b == ZERO)
+                    return this->copy(a == ZERO ? second_reg : first_reg, out_reg, n, lane);
+                simd_tools::add(first, second, out, n);
+                fact = this->combined(a, b, out);
+                return;
+            case OP_SUB:
+                if (b == ZERO)
+                    return this->copy(first_reg, out_reg, n, lane);
+                simd_tools::sub(first, second, out, n);
+                fact = this->combined(a, b, out);
+                return;
+            case OP_MULT:
+                if (a == ZERO || b == ZERO)
+                    return this->fill(T{0}, out_reg, n, lane);
+                simd_tools::mult(first, second, out, n);
+                fact = this->combined(a, b, out);
+                return;
+            case OP_DIV:
+                simd_tools::div(first, second, out, n);
+                fact = this->combined(a, b, out);
+                return;
+            case OP_CALL: {
+                auto func = this->funcs_[this->payloads_[i]];
+                if (a != VARYING)
+                    return this->fill((*func)(first[0]), out_reg, n, lane);
+                for (std::size_t j = 0; j < n; ++j) out[j] = (*func)(first[j]);
+                break;
+            }
+            case OP_SOURCE:
+                // May carry state, so it's always called for the whole block.
+                this->nodes_[this->payloads_[i]]->source_ptr_->render(first, out, n);
+                break;
+            case OP_PARAM:
+                return this->fill(this->nodes_[this->payloads_[i]]->param_ptr_[lane * this->lane_stride_], out_reg, n, lane);
+            case OP_CACHE:
+                CYNTH_PROFILE_COUNT(this->nodes_[this->payloads_[i]]->profile_.cache_hits, a != VARYING ? 1 : n);
+                if (a != VARYING)
+                    return this->fill((*this->nodes_[this->payloads_[i]]->cache_ptr_)(first[0]), out_reg, n, lane);
+                this->nodes_[this->payloads_[i]]->cache_ptr_->render(first, out, n);
+                break;
+            case OP_CONV: {
+                auto node = this->nodes_[this->payloads_[i]];
+                if (a != VARYING)
+                    return this->fill(node->conv(first[0]), out_reg, n, lane);
+                for (std::size_t j = 0; j < n; ++j) out[j] = node->conv(first[j]);
+                break;
+            }
+            case OP_CONTROL: {
+                auto node = this->nodes_[this->payloads_[i]];
+                if (a != VARYING)
+                    return this->fill((*node)(first[0]), out_reg, n, lane);
+                node->render_control(first, out, n);
+                break;
+            }
+            case OP_FIR:
+                this->execute_fir(this->firs_[this->payloads_[i] * this->lanes_ + lane], this->reg(input_register)[offset], first, out, n);
+                break;
+            }
+            fact = this->scan(out, n);
+        }
+
+        // Facts of the result of an arithmetic operation, zero operands are handled by the caller.
+        static fact_enum combined (fact_enum a, fact_enum b, const T* out) {
+            if (a == VARYING || b == VARYING)
+                return VARYING;
+            return out[0] == 0 ? ZERO : UNIFORM;
+        }
+
+        // Facts of a block produced by an opaque instruction. Stops at the first differing sample.
+        static fact_enum scan (const T* out, std::size_t n) {
+            for (std::size_t j = 1; j < n; ++j)
+                if (out[j] != out[0])
+                    return VARYING;
+            return out[0] == 0 ? ZERO : UNIFORM;
+        }
+
+        void copy (index_t from, index_t to, std::size_t n, std::size_t lane) {
+            if (from != to)
+                std::copy(this->reg(from) + lane * n, this->reg(from) + (lane + 1) * n, this->reg(to) + lane * n);
+            this->fact(to, lane) = this->fact(from, lane);
+        }
+
+        void fill (T value, index_t to, std::size_t n, std::size_t lane) {
+            std::fill(this->reg(to) + lane * n, this->reg(to) + (lane + 1) * n, value);
+            this->fact(to, lane) = value == 0 ? ZERO : UNIFORM;
+        }
+
+        void execute_fir (fir_state& fir, T t0, const T* signal, T* out, std::size_t n) {
+            auto  dt  = this->block_step_;
+            // Off the kernel's tap spacing, the streamed signal would be read at the wrong times
+            // (with several lanes, direct evaluation sees the parameters of the first one):
+            if (std::abs(dt - fir.step) > fir.step * T{1e-3}) {
+                for (std::size_t j = 0; j < n; ++j)
+                    out[j] = fir.node->conv(t0 + static_cast<T>(j) * dt);
+                fir.primed = false;
+                return;
+            }
+            // Tolerates the rounding of large time values:
+            auto tolerance = std::max(dt / 2, std::abs(t0) * std::numeric_limits<T>::epsilon() * 4);
+            if (!fir.primed || std::abs(t0 - fir.next_time) > tolerance) {
+                // The parameters of the other lanes are not visible to direct evaluation.
+                if (this->lanes_ > 1)
+                    fir.filter.reset([] (std::size_t) { return T{0}; });
+                else
+                    fir.filter.reset([&] (std::size_t j) { return fir.node->second(t0 - static_cast<T>(j) * dt); });
+                fir.primed = true;
+            }
+            fir.filter.process(signal, out, n);
+            fir.next_time = t0 + static_cast<T>(n) * dt;
+        }
+
+        struct skip_guard {
+            index_t condition; // Register that skips the range when zero.
+            index_t begin;     // First instruction of the second operand.
+            index_t target;    // The multiplication.
+        };
+
+        struct guard_candidate {
+            std::size_t              condition;
+            std::size_t              operand;
+            std::size_t              out;
+            std::vector<std::size_t> cone; // Registers written while lowering the second operand.
+        };
+
+        using value_key    = std::tuple<opcode_enum, std::size_t, std::size_t, std::uintptr_t, const function_t*>;
+        using constant_key = std::conditional_t<sizeof(T) == sizeof(std::uint32_t), std::uint32_t, std::uint64_t>;
+
+        std::size_t                        lanes_;
+        std::size_t                        lane_stride_;
+        std::vector<T>                     lane_times_;
+        container_tools::aligned_vector<T> registers_; // Register i starts at i * lanes_ * block_size.
+        std::vector<std::uint8_t>          opcodes_;
+        std::vector<index_t>               outs_;
+        std::vector<index_t>               firsts_;
+        std::vector<index_t>               seconds_;
+        std::vector<index_t>               payloads_; // Index into funcs_, nodes_ or firs_, depending on the opcode.
+        std::vector<func_ptr_t>            funcs_;
+        std::vector<const function_t*>     nodes_;
+        std::vector<fir_state>             firs_;     // lanes_ entries per filter.
+        std::vector<fact_enum>             facts_;        // Register r, lane l at r * lanes_ + l.
+        std::vector<std::size_t>           lane_skips_;   // Per task and lane, see run_range().
+        std::vector<unsigned_t>            executed_;     // Per task.
+        const bool*                        lane_active_ = nullptr; // Mask of the lanes to compute, see render_lanes().
+        std::vector<skip_guard>            guards_;
+        std::vector<index_t>               guard_index_; // Guards starting at instruction i: guards_[guard_index_[i]] ... guards_[guard_index_[i + 1]]
+        parallel_tools::worker_pool*       pool_          = nullptr;
+        parallel_tools::task_graph         tasks_;
+        std::vector<index_t>               task_begins_;  // Task t runs instructions task_begins_[t] ... task_begins_[t + 1].
+        #ifdef CYNTH_PROFILE
+        std::vector<profiling::node_profile> profiles_;
+        #endif
+        T                                  block_step_    = 0;
+        std::size_t                        result_        = input_register;
+        std::size_t                        shared_count_  = 0;
+        std::size_t                        removed_count_ = 0;
+
+        // Compilation state:
+        std::vector<instruction>                                           program_;
+        std::size_t                                                        virtual_count_ = 1; // Register 0 is the input.
+        std::vector<guard_candidate>                                       guard_candidates_;
+        std::map<std::pair<const function_t*, std::size_t>, std::size_t> lowered_;
+        std::map<value_key, std::size_t>                                   values_;
+        std::map<constant_key, std::size_t>                                constants_;
+        std::map<std::size_t, T>                                           constant_values_;
+        std::map<std::size_t, std::size_t>                                 producers_; // Register -> index of the instruction writing it.
+    };
+
+}
@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <string>
 #include <vector>
+#include <new>
 
 namespace cynth::container_tools {
 
@@ -45,6 +46,31 @@ namespace cynth::container_tools {
         char**      data_;
     };
 
+    // Allocates memory aligned for the widest vector registers (64 B for AVX-512).
+    template <typename T, std::size_t ALIGNMENT = 64>
+    class aligned_allocator {
+    public:
+        using value_type = T;
+
+        template <typename U> struct rebind { using other = aligned_allocator<U, ALIGNMENT>; };
+
+        aligned_allocator () = default;
+        template <typename U> aligned_allocator (const aligned_allocator<U, ALIGNMENT>&) {}
+
+        T* allocate (std::size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{ALIGNMENT}));
+        }
+        void deallocate (T* ptr, std::size_t) {
+            ::operator delete(ptr, std::align_val_t{ALIGNMENT});
+        }
+
+        template <typename U> bool operator == (const aligned_allocator<U, ALIGNMENT>&) const { return true; }
+        template <typename U> bool operator != (const aligned_allocator<U, ALIGNMENT>&) const { return false; }
+    };
+
+    template <typename T>
+    using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
     /*template <typename T>
     class dynamic_array {
     public:
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "config.hpp"
+#include "containertools.hpp"
+#include "simdtools.hpp"
+#include "mathtools.hpp"
+
+#include <cstddef>
+#include <vector>
+#include <complex>
+#include <algorithm>
+
+namespace cynth {
+
+    // Direct form FIR filter over a stream of samples:
+    // out[k] = sum of kernel[i] * in[k - i] for i in [0, size)
+    // The kernel is stored reversed in an aligned array and the input history is kept
+    // in a ring buffer stored twice in a row, so that the last `size` samples are always
+    // contiguous and every output is a single SIMD dot product.
+    template <typename T>
+    class fir_filter {
+    public:
+        fir_filter (const std::vector<T>& kernel):
+            size_         {kernel.size()},
+            coefficients_ (kernel.rbegin(), kernel.rend()),
+            history_      (2 * kernel.size(), 0) {}
+
+        std::size_t size () const { return this->size_; }
+
+        // Refills the history with past inputs. past(j) is the input j samples before the next one.
+        template <typename Past>
+        void reset (Past past) {
+            this->position_ = 0;
+            for (std::size_t j = 0; j < this->size_; ++j)
+                this->history_[j] = this->history_[j + this->size_] = past(this->size_ - j);
+        }
+
+        void process (const T* in, T* out, std::size_t n) {
+            auto history      = this->history_.data();
+            auto coefficients = this->coefficients_.data();
+            for (std::size_t k = 0; k < n; ++k) {
+                history[this->position_] = history[this->position_ + this->size_] = in[k];
+                this->position_ = this->position_ + 1 == this->size_ ? 0 : this->position_ + 1;
+                // history[position_] is the oldest sample, history[position_ + size_ - 1] the newest.
+                out[k] = simd_tools::dot(history + this->position_, coefficients, this->size_);
+            }
+        }
+
+    private:
+        std::size_t                       size_;
+        container_tools::aligned_vector<T> coefficients_;
+        container_tools::aligned_vector<T> history_;
+        std::size_t                       position_ = 0;
+    };
+
+    // Convolution with long kernels:
+    // The first partition of the kernel (the head) is applied directly by a fir_filter,
+    // the rest (the tail) by uniformly partitioned overlap-save convolution in the frequency domain.
+    // Every partition of the tail is transformed once here. Whenever a block of `partition` inputs is complete,
+    // it is transformed (together with the previous block), stored in a frequency-domain delay line
+    // and the tail contribution for the whole next block is computed by one multiply-accumulate
+    // per partition and one inverse FFT.
+    // The tail only needs inputs at least one partition old, so the output is not delayed at all
+    // and the per-block cost does not depend on when the block boundaries fall.
+    template <typename T>
+    class partitioned_convolver {
+    public:
+        using complex_t  = std::complex<T>;
+        using spectrum_t = std::vector<complex_t>;
+
+        // The partition size must be a power of two, unless it covers the whole kernel.
+        // In that case no FFT is needed at all and this is just a fir_filter.
+        partitioned_convolver (const std::vector<T>& kernel, std::size_t partition):
+            partition_ {partition},
+            count_     {(kernel.size() + partition - 1) / partition},
+            head_      {std::vector<T>(kernel.begin(), kernel.begin() + std::min(partition, kernel.size()))},
+            fft_       {this->count_ > 1 ? 2 * partition : 0},
+            previous_  (partition, 0),
+            current_   (partition, 0),
+            tail_      (partition, 0),
+            buffer_    (2 * partition) {
+
+            for (std::size_t k = 1; k < this->count_; ++k) {
+                spectrum_t spectrum(2 * partition, complex_t{0});
+                for (std::size_t j = 0; j < partition && k * partition + j < kernel.size(); ++j)
+                    spectrum[j] = kernel[k * partition + j];
+                this->fft_.forward(spectrum.data());
+                this->kernel_spectra_.push_back(std::move(spectrum));
+                this->input_spectra_.emplace_back(2 * partition, complex_t{0});
+            }
+        }
+
+        std::size_t size () const { return this->head_.size() + (this->count_ - 1) * this->partition_; }
+
+        // Refills the history with past inputs. past(j) is the input j samples before the next one.
+        template <typename Past>
+        void reset (Past past) {
+            this->head_.reset(past);
+            this->position_ = 0;
+            if (this->count_ < 2)
+                return;
+            // Block d blocks back consists of past(d * partition) ... past(d * partition - partition + 1).
+            auto block = [&] (std::size_t d, std::vector<T>& into) {
+                for (std::size_t i = 0; i < this->partition_; ++i)
+                    into[i] = past(d * this->partition_ - i);
+            };
+            for (std::size_t d = this->count_ - 1; d >= 1; --d) {
+                block(d + 1, this->previous_);
+                block(d,     this->current_);
+                this->push_block();
+            }
+        }
+
+        void process (const T* in, T* out, std::size_t n) {
+            this->head_.process(in, out, n);
+            if (this->count_ < 2)
+                return;
+            for (std::size_t k = 0; k < n; ++k) {
+                this->current_[this->position_] = in[k];
+                out[k] += this->tail_[this->position_];
+                if (++this->position_ == this->partition_) {
+                    this->push_block();
+                    this->position_ = 0;
+                }
+            }
+        }
+
+    private:
+        // Transforms the last two input blocks and computes the tail of the next block.
+        void push_block () {
+            auto p = this->partition_;
+            for (std::size_t i = 0; i < p; ++i) {
+                this->buffer_[i]     = this->previous_[i];
+                this->buffer_[p + i] = this->current_[i];
+            }
+            this->fft_.forward(this->buffer_.data());
+            this->newest_ = this->newest_ + 1 == this->input_spectra_.size() ? 0 : this->newest_ + 1;
+            std::swap(this->input_spectra_[this->newest_], this->buffer_);
+            std::swap(this->previous_, this->current_);
+
+            // Partition k applies to the input block k blocks before the output block:
+            std::fill(this->buffer_.begin(), this->buffer_.end(), complex_t{0});
+            auto count = this->input_spectra_.size();
+            for (std::size_t k = 0; k < count; ++k) {
+                auto& input  = this->input_spectra_[(this->newest_ + count - k) % count];
+                auto& kernel = this->kernel_spectra_[k];
+                for (std::size_t i = 0; i < 2 * p; ++i)
+                    this->buffer_[i] += input[i] * kernel[i];
+            }
+            this->fft_.inverse(this->buffer_.data());
+            // Overlap-save: Only the second half is free of circular wrap-around.
+            for (std::size_t i = 0; i < p; ++i)
+                this->tail_[i] = this->buffer_[p + i].real();
+        }
+
+        std::size_t             partition_;
+        std::size_t             count_;
+        fir_filter<T>           head_;
+        math_tools::fft<T>      fft_;
+        std::vector<spectrum_t> kernel_spectra_; // Partitions 1 ... count - 1
+        std::vector<spectrum_t> input_spectra_;  // Frequency-domain delay line
+        std::size_t             newest_   = 0;
+        std::vector<T>          previous_;
+        std::vector<T>          current_;
+        std::vector<T>          tail_;
+        spectrum_t              buffer_;
+        std::size_t             position_ = 0;
+    };
+
+}
\ No newline at end of file
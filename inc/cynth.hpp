@@ -4,6 +4,7 @@
 
 #include "devices/oscillator.hpp"
 #include "devices/filter.hpp"
+#include "devices/voices.hpp"
 
 #if 0
 /* Platform setup: */
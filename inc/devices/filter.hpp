@@ -4,13 +4,16 @@
 
 namespace cynth {
 
-    class filter: public function_holder<5> {
+    class filter: public arena_holder {
     public:
+        // The intermediate functions are stored in the given arena, or in a private one.
+        filter (wave_arena* arena = nullptr): arena_holder{arena} {}
+
         wave_function        cutoff           = 5000; // Hz
         const wave_function& impulse_response = this->windowed_;
 
-        void set_cache (wave_function::cache_t& cache) {
-            this->windowed_.set_cache(wave_function::floating_time(wave_function::filter_order), cache);
+        void set_cache (wave_function::cache_t& cache, interpolation_enum interpolation = LINEAR, std::size_t threads = 1) {
+            this->windowed_.set_cache(wave_function::floating_time(wave_function::filter_order), cache, interpolation, threads);
         }
     
     private:
@@ -2,28 +2,126 @@
 
 #include "config.hpp"
 #include "functional.hpp"
+#include "static_functional.hpp"
+
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <limits>
 
 namespace cynth {
 
-    class oscillator: public function_holder<4> {
+    // Phase of an oscillator advanced sample by sample instead of computed from the absolute time.
+    // The phase is a 32-bit fixed-point fraction of a period, so it wraps around for free and its
+    // precision does not depend on how long the stream has been running. The frequency is evaluated
+    // at every sample and integrated, so modulating it bends the pitch without jumps in the phase.
+    // A sine wave is read from the wavetable directly by the phase, other waves get the phase in radians.
+    // The accumulator follows one stream of evenly spaced sample times (the spacing is taken from the times,
+    // so it does not depend on wave_function::sample_length), when the times jump
+    // (or when evaluated sample by sample), the phase is derived from the absolute time again.
+    class phase_accumulator: public function_source<floating_t> {
+    public:
+        phase_accumulator (const wave_function& freq, const wave_function& wave): freq_{freq}, wave_{wave} {}
+
+        floating_t operator() (floating_t t) const override {
+            return this->wave_(t * this->freq_(t) * (2*constants::pi));
+        }
+
+        void render (const floating_t* in, floating_t* out, std::size_t n) const override {
+            for (std::size_t offset = 0; offset < n; offset += wave_function::block_size)
+                this->render_block(in + offset, out + offset, std::min(wave_function::block_size, n - offset));
+        }
+
+        unsigned_t revision () const override {
+            return std::max(this->freq_.latest_revision(), this->wave_.latest_revision());
+        }
+
+    private:
+        inline constexpr static double period = 4294967296.; // 2^32
+
+        void render_block (const floating_t* in, floating_t* out, std::size_t n) const {
+            wave_function::block_t freq;
+            this->freq_.render(in, freq.data(), n);
+
+            floating_t dt = n > 1 ? in[1] - in[0] : this->step_;
+            auto tolerance = std::max<floating_t>(dt / 2, std::abs(in[0]) * std::numeric_limits<floating_t>::epsilon() * 4);
+            if (!this->running_ || std::abs(in[0] - this->next_time_) > tolerance) {
+                double cycles = static_cast<double>(in[0]) * freq[0];
+                // The fraction may round up to 1, which wraps to 0 through the 64-bit value:
+                this->phase_   = static_cast<std::uint32_t>(static_cast<std::uint64_t>((cycles - std::floor(cycles)) * period));
+                this->running_ = true;
+            }
+            this->next_time_ = in[n - 1] + dt;
+            this->step_      = dt;
+
+            double step = period * dt;
+            auto   phase = this->phase_;
+            if (this->wave_.func_ptr() == wave_fs::sin.func_ptr()) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    out[i] = wavetables::sin[(std::uint64_t{phase} * wavetable::size) >> 32];
+                    phase += static_cast<std::uint32_t>(std::llround(freq[i] * step));
+                }
+            } else {
+                for (std::size_t i = 0; i < n; ++i) {
+                    out[i] = static_cast<floating_t>(phase * (2*constants::pi / period));
+                    phase += static_cast<std::uint32_t>(std::llround(freq[i] * step));
+                }
+                this->wave_.render(out, out, n);
+            }
+            this->phase_ = phase;
+        }
+
+        const wave_function& freq_;
+        const wave_function& wave_;
+
+        mutable std::uint32_t phase_     = 0;
+        mutable floating_t    next_time_ = 0;
+        mutable floating_t    step_      = wave_function::sample_length; // Spacing of the last block.
+        mutable bool          running_   = false;
+    };
+
+    enum oscillator_mode_enum { ABSOLUTE_TIME, PHASE_ACCUMULATOR };
+
+    class oscillator: public arena_holder {
     public:
-        oscillator ():
+        // The intermediate functions are stored in the given arena, or in a private one.
+        oscillator (wave_arena* arena = nullptr, oscillator_mode_enum mode = ABSOLUTE_TIME):
+            arena_holder{arena},
             amp{0.5},
             freq{220},
             shift{0},
             wave{wave_fs::sin},
-            out_{f(this->amp * f(this->wave(f(t{} * f(this->freq * (2*constants::pi)))))) + this->shift} {}
+            phase_{this->freq, this->wave},
+            time_out_{f(f(this->amp * f(this->wave(f(t{} * f(this->freq * (2*constants::pi)))))) + this->shift)},
+            phase_out_{f(f(this->amp * f(wave_function{this->phase_})) + this->shift)},
+            out_{mode == PHASE_ACCUMULATOR ? this->phase_out_ : this->time_out_},
+            mode_{mode} {}
             // Equivalent to:
             // this->amp_ * this->wave_(t{} * this->freq_ * 2 * constants::pi)
-            // But that would use pointers to temporary values. Method f() stores the values and returns a reference.
-            // Up to 4 such intermediate functions may be stored. It's configurable with the template parameter of function_holder<N>.
+            // But that would use pointers to temporary values. Method f() stores the values in the arena and returns a reference.
 
         floating_t operator() (floating_t t) { return this->out(t); }
 
         operator wave_function () const { return this->out; }
 
-        void set_cache (floating_t period, wave_function::cache_t& cache) {
-            this->out_.set_cache(period, cache);
+        void set_cache (floating_t period, wave_function::cache_t& cache, interpolation_enum interpolation = LINEAR, std::size_t threads = 1) {
+            this->out_.set_cache(period, cache, interpolation, threads);
+        }
+
+        // ABSOLUTE_TIME: wave(t * freq * 2pi), a pure function of the time.
+        // PHASE_ACCUMULATOR: The phase is advanced by freq at every sample (see phase_accumulator).
+        // Cheaper and stable over long sessions, but the output depends on the previous blocks,
+        // so it is meant for streams of consecutive blocks (e.g. the driver) and not for caching.
+        oscillator_mode_enum mode () const { return this->mode_; }
+
+        // A cache set by set_cache() is kept and refilled from the new output.
+        void set_mode (oscillator_mode_enum mode) {
+            auto cache  = this->out_.cache();
+            this->mode_ = mode;
+            this->out_  = mode == PHASE_ACCUMULATOR ? this->phase_out_ : this->time_out_;
+            if (cache)
+                this->out_.set_cache(cache->period(), *cache, cache->interpolation());
         }
 
         // Access to the wave functions is done without any accessor functions.
@@ -40,11 +138,58 @@ namespace cynth {
         wave_function wave;
 
     private:
+        phase_accumulator    phase_;
+        const wave_function& time_out_;
+        const wave_function& phase_out_;
         // Modulated output:
-        wave_function out_;
+        wave_function        out_;
+        oscillator_mode_enum mode_;
     
     public:
         const wave_function& out = out_;
     };
 
+    template <typename Wave>
+    constexpr auto static_oscillator_out (const floating_t& amp, const floating_t& freq, const floating_t& shift, const Wave& wave) {
+        return static_param(amp) * wave(static_t{} * static_param(freq) * (2*constants::pi)) + static_param(shift);
+    }
+
+    // An oscillator with a fixed structure.
+    // The whole output expression is fused at compile time, the parameters are plain values read on every sample.
+    // Its output is still available as a wave_function, so it can be used in runtime graphs.
+    template <typename Wave = static_fs::sin_t>
+    class static_oscillator {
+    public:
+        static_oscillator (floating_t amp = 0.5, floating_t freq = 220, floating_t shift = 0):
+            amp{amp},
+            freq{freq},
+            shift{shift} {}
+
+        // The output expression references the parameters of this object.
+        static_oscillator (const static_oscillator&) = delete;
+        static_oscillator& operator = (const static_oscillator&) = delete;
+
+        floating_t operator() (floating_t t) const { return this->out_(t); }
+
+        void render (floating_t t0, floating_t dt, floating_t* out, std::size_t n) const { this->out_.render(t0, dt, out, n); }
+
+        operator wave_function () const { return this->out; }
+
+        floating_t amp;
+        floating_t freq;
+        floating_t shift;
+
+    private:
+        using out_t = decltype(static_oscillator_out(
+            std::declval<const floating_t&>(),
+            std::declval<const floating_t&>(),
+            std::declval<const floating_t&>(),
+            std::declval<const Wave&>()));
+
+        out_t out_ = static_oscillator_out(this->amp, this->freq, this->shift, Wave{});
+
+    public:
+        const wave_function out = out_;
+    };
+
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "config.hpp"
+#include "functional.hpp"
+#include "compiled_function.hpp"
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+namespace cynth {
+
+    // A polyphonic device playing a fixed number of voices of one template graph.
+    // The template is built from the per-voice inputs of this device and uses
+    // the time since the note on of its voice as the input variable:
+    //
+    //     voice_allocator voices{16};
+    //     oscillator o;
+    //     o.freq = voices.freq;
+    //     o.amp  = voices.velocity;
+    //     voices.set_voice(o.out);
+    //     auto id = voices.note_on(440);
+    //
+    // All voices are compiled into one program with a lane per voice, so each arithmetic
+    // instruction advances all of them in one vector loop. Only the lanes of active voices are
+    // computed, so idle voices cost nothing. A note goes to a free voice. When all
+    // of them are busy, the voice released the longest ago is stolen, or the oldest one if none is.
+    // A released voice keeps playing (with gate = 0) for release_time, then it becomes free.
+    // The device is evaluated as a stream of consecutive blocks, like phase_accumulator.
+    // Notes are started at the end of the last rendered block, so note_on and note_off
+    // must be called between the renders.
+    class voice_allocator: public function_source<floating_t> {
+    public:
+        enum parameter_enum { FREQ, VELOCITY, GATE, PARAMETER_COUNT };
+
+        voice_allocator (std::size_t count):
+            parameters_ (count * PARAMETER_COUNT, 0),
+            voices_     (count),
+            program_    {wave_function{floating_t{0}}, count, PARAMETER_COUNT},
+            lane_times_  (count, 0),
+            lane_active_ (std::make_unique<bool[]>(count)),
+            lane_out_    (count * wave_function::block_size, 0) {}
+
+        voice_allocator (const voice_allocator&) = delete;
+        voice_allocator& operator = (const voice_allocator&) = delete;
+
+        std::size_t size () const { return this->voices_.size(); }
+
+        // The template graph must outlive this device (or the next call of set_voice).
+        void set_voice (const wave_function& voice) {
+            this->program_  = compiled_function<floating_t>{voice, this->size(), PARAMETER_COUNT};
+            this->revision_ = ++revision_clock;
+        }
+
+        // Returns the voice playing the note.
+        std::size_t note_on (floating_t freq, floating_t velocity = 1) {
+            auto voice = this->allocate();
+            auto& state = this->voices_[voice];
+            state.active   = true;
+            state.released = false;
+            state.start    = this->now_;
+            state.order    = this->order_++;
+            this->set(voice, FREQ,     freq);
+            this->set(voice, VELOCITY, velocity);
+            this->set(voice, GATE,     1);
+            this->revision_ = ++revision_clock;
+            return voice;
+        }
+
+        void note_off (std::size_t voice) {
+            auto& state = this->voices_[voice];
+            if (!state.active || state.released)
+                return;
+            state.released = true;
+            state.release  = this->now_;
+            state.order    = this->order_++;
+            this->set(voice, GATE, 0);
+            this->revision_ = ++revision_clock;
+        }
+
+        std::size_t active_count () const {
+            return std::count_if(this->voices_.begin(), this->voices_.end(), [] (const voice_t& voice) { return voice.active; });
+        }
+
+        // Every note and every change of the template is a new revision (the template graph itself is not walked).
+        unsigned_t revision () const override { return this->revision_; }
+
+        floating_t operator() (floating_t t) const override {
+            floating_t result;
+            this->render(&t, &result, 1);
+            return result;
+        }
+
+        // Only in[0] and the spacing of the inputs are used, the block is taken as consecutive samples.
+        void render (const floating_t* in, floating_t* out, std::size_t n) const override {
+            if (!n)
+                return;
+            floating_t dt = n > 1 ? in[1] - in[0] : wave_function::sample_length;
+            for (std::size_t offset = 0; offset < n; offset += wave_function::block_size)
+                this->render_block(in[0] + static_cast<floating_t>(offset) * dt, dt, out + offset, std::min(wave_function::block_size, n - offset));
+        }
+
+    private:
+        std::vector<floating_t> parameters_; // Voice v, parameter p at v * PARAMETER_COUNT + p.
+
+    public:
+        // Per-voice inputs of the template:
+        const wave_function freq     = wave_function::parameter(this->parameters_[FREQ]);
+        const wave_function velocity = wave_function::parameter(this->parameters_[VELOCITY]);
+        const wave_function gate     = wave_function::parameter(this->parameters_[GATE]); // 1 while the note is held.
+
+        floating_t release_time = 0; // Seconds
+
+        // Work done by the program so far, see compiled_function::executed_count().
+        unsigned_t executed_count () const { return this->program_.executed_count(); }
+
+    private:
+        struct voice_t {
+            bool       active   = false;
+            bool       released = false;
+            floating_t start    = 0;
+            floating_t release  = 0;
+            unsigned_t order    = 0; // Of the last note on/off.
+        };
+
+        void set (std::size_t voice, parameter_enum parameter, floating_t value) {
+            this->parameters_[voice * PARAMETER_COUNT + parameter] = value;
+        }
+
+        std::size_t allocate () const {
+            auto begin = this->voices_.begin();
+            auto end   = this->voices_.end();
+            auto free  = std::find_if(begin, end, [] (const voice_t& voice) { return !voice.active; });
+            if (free != end)
+                return free - begin;
+            // Stealing: released voices first, the longest ago (or the oldest started) first.
+            return std::min_element(begin, end, [] (const voice_t& a, const voice_t& b) {
+                return a.released != b.released ? a.released : a.order < b.order;
+            }) - begin;
+        }
+
+        void render_block (floating_t t0, floating_t dt, floating_t* out, std::size_t n) const {
+            for (auto& voice: this->voices_)
+                if (voice.active && voice.released && t0 - voice.release >= this->release_time)
+                    voice.active = false;
+
+            std::fill(out, out + n, floating_t{0});
+            if (this->active_count()) {
+                for (std::size_t lane = 0; lane < this->size(); ++lane) {
+                    this->lane_times_[lane]  = t0 - this->voices_[lane].start;
+                    this->lane_active_[lane] = this->voices_[lane].active;
+                }
+                this->program_.render_lanes(this->lane_times_.data(), dt, this->lane_out_.data(), n, this->lane_active_.get());
+                for (std::size_t lane = 0; lane < this->size(); ++lane)
+                    if (this->voices_[lane].active)
+                        simd_tools::add(out, this->lane_out_.data() + lane * n, out, n);
+            }
+            this->now_ = t0 + static_cast<floating_t>(n) * dt;
+        }
+
+        mutable std::vector<voice_t>          voices_;
+        mutable compiled_function<floating_t> program_;
+        mutable std::vector<floating_t>       lane_times_;
+        std::unique_ptr<bool[]>               lane_active_; // Mask of the active voices passed to the program.
+        mutable std::vector<floating_t>       lane_out_;
+        mutable floating_t                    now_      = 0;
+        unsigned_t                            order_    = 0;
+        unsigned_t                            revision_ = 0;
+    };
+
+}
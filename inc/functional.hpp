@@ -3,10 +3,24 @@
 #include "config.hpp"
 #include "exceptions.hpp"
 #include "wavetables.hpp"
+#include "simdtools.hpp"
+#include "paralleltools.hpp"
+#include "profiling.hpp"
 
 #include <tuple>
 #include <complex>
 #include <array>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <ostream>
 
 namespace cynth {
     
@@ -37,16 +51,172 @@ namespace cynth {
 
     enum operation_enum { CONSTANT, ADD, SUB, MULT, DIV, COMP, CONV };
 
+    template <typename T> class compiled_function;
+
+    // Dependency tracking (see composite_function::latest_revision): Every change of a graph takes a new value.
+    inline std::atomic<unsigned_t> revision_clock {0};
+
+    // Revision of a plain value read by a graph (a parameter), which may be written without notice
+    // (e.g. by a parameter event): A new revision is taken whenever the value is found changed.
+    template <typename T>
+    class value_revision {
+    public:
+        unsigned_t operator() (T value) const {
+            if (!this->revision_ || value != this->seen_) {
+                this->seen_     = value;
+                this->revision_ = ++revision_clock;
+            }
+            return this->revision_;
+        }
+
+    private:
+        mutable T          seen_     = 0;
+        mutable unsigned_t revision_ = 0;
+    };
+
+    // A function evaluated outside of the composite_function graph (e.g. a static_function expression).
+    // Unlike function_wrapper, it may carry state, so it is referenced rather than copied.
+    template <typename T>
+    class function_source {
+    public:
+        virtual T    operator() (T in) const = 0;
+        virtual void render (const T* in, T* out, std::size_t n) const = 0;
+
+        // The latest revision of what the source depends on, so that caches over it are refreshed when it changes.
+        // Untracked sources keep 0: Caches over them must be refilled by hand.
+        virtual unsigned_t revision () const { return 0; }
+
+    protected:
+        ~function_source () = default;
+    };
+
+    enum interpolation_enum { NEAREST, LINEAR, CUBIC };
+
+    // One period of a function sampled at (at least) the sample rate.
+    // The samples are spaced evenly over exactly one period, so periods that are not
+    // a whole number of samples long do not drift. Any time is mapped onto an integer
+    // sample index and a fraction between it and the next sample. The number of samples
+    // is rounded up to a power of two, so the index wraps around the period with a mask.
+    // A fill builds a new table and publishes it through an rcu_slot, so a cache can be refilled
+    // on another thread while the audio thread reads it. The previous table is destroyed by the fill
+    // once no thread is reading it, so a reader that loaded it just before the swap can finish its block.
+    template <typename T>
+    class function_cache {
+    public:
+        function_cache () = default;
+        function_cache (const function_cache&) = delete;
+        function_cache& operator = (const function_cache&) = delete;
+
+        // These expect a filled cache:
+        std::size_t        size          () const { return reader{this->table_}->size; }
+        T                  period        () const { return reader{this->table_}->period; }
+        interpolation_enum interpolation () const { return reader{this->table_}->interpolation; }
+        floating_t         sample_rate   () const { return reader{this->table_}->sample_rate; }
+        // Revision of the sampled graph at the time of the fill.
+        unsigned_t         revision      () const { return reader{this->table_}->revision; }
+
+        bool filled () const { return !this->table_.empty(); }
+
+        // render(in, out, n) must evaluate the function at n input times.
+        template <typename Render>
+        void fill (T period, floating_t sample_rate, interpolation_enum interpolation, unsigned_t revision, Render render) {
+            if (!(period > 0))
+                throw cynth_exception{"Function cache period must be positive."};
+            auto next = std::make_unique<table_t>();
+            next->size          = power_of_two(static_cast<std::size_t>(std::lround(period * sample_rate)));
+            next->period        = period;
+            next->rate          = static_cast<double>(next->size) / period;
+            next->sample_rate   = sample_rate;
+            next->interpolation = interpolation;
+            next->revision      = revision;
+
+            std::vector<T> times(next->size);
+            for (std::size_t i = 0; i < next->size; ++i)
+                times[i] = static_cast<T>(i / next->rate);
+            // samples[i + 1] holds sample i. One more sample before and two after
+            // are copied from the other end of the period, so interpolation never wraps.
+            auto& samples = next->samples;
+            samples.resize(next->size + 3);
+            render(times.data(), samples.data() + 1, next->size);
+            samples[0]              = samples[next->size];
+            samples[next->size + 1] = samples[1];
+            samples[next->size + 2] = samples[1 + 1 % next->size];
+
+            this->table_.publish(std::move(next));
+        }
+
+        T operator() (T in) const { return lookup(*reader{this->table_}, in); }
+
+        void render (const T* in, T* out, std::size_t n) const {
+            reader table{this->table_};
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = lookup(*table, in[i]);
+        }
+
+    private:
+        struct table_t {
+            std::vector<T>     samples;
+            std::size_t        size;
+            T                  period;
+            double             rate; // Samples per unit of time.
+            floating_t         sample_rate;
+            interpolation_enum interpolation;
+            unsigned_t         revision;
+        };
+
+        // The smallest power of two not less than n (and at least 1).
+        static std::size_t power_of_two (std::size_t n) {
+            std::size_t result = 1;
+            while (result < n)
+                result <<= 1;
+            return result;
+        }
+
+        static T lookup (const table_t& table, T in) {
+            double      phase = static_cast<double>(in) * table.rate;
+            double      whole = std::floor(phase);
+            T           frac  = static_cast<T>(phase - whole);
+            // Two's complement wraps negative times around the period as well:
+            auto        index = static_cast<std::size_t>(static_cast<long long>(whole)) & (table.size - 1);
+            const T*    p     = table.samples.data() + 1 + index;
+            switch (table.interpolation) {
+            case NEAREST: default:
+                return frac < T{0.5} ? p[0] : p[1];
+            case LINEAR:
+                return p[0] + frac * (p[1] - p[0]);
+            case CUBIC:
+                // Catmull-Rom spline through p[-1] ... p[2]:
+                return p[0] + frac / 2 * (p[1] - p[-1]
+                    + frac * (2 * p[-1] - 5 * p[0] + 4 * p[1] - p[2]
+                    + frac * (3 * (p[0] - p[1]) + p[2] - p[-1])));
+            }
+        }
+
+        using reader = typename parallel_tools::rcu_slot<table_t>::reader;
+
+        parallel_tools::rcu_slot<table_t> table_;
+    };
+
     template <typename T>
     class composite_function {
     public:
         using func_t     = function_wrapper<T, T>;
         using func_ptr_t = typename func_t::func_ptr_t;
 
-        inline constexpr static std::size_t cache_size    = 1024;
+        using cache_t    = function_cache<T>;
+
+        // Maximum number of samples evaluated in one pass through the tree.
+        // Longer blocks are split into chunks of this size.
+        inline constexpr static std::size_t block_size    = 256;
+
+        using block_t    = std::array<T, block_size>;
 
-        using cache_t    = std::array<T, cache_size>;
+        // Samples between two evaluations of a control-rate node (see set_control_rate()).
+        inline constexpr static std::size_t default_control_interval = 32;
 
+        // Taps of a convolution. It stays short, because composite_function::conv and static_convolution
+        // evaluate both operands at every tap of every sample. Compiled programs would take 512 taps
+        // (from compiled_function::fft_threshold on, the kernel is applied in the frequency domain).
         //inline constexpr static std::size_t filter_order  = 512;
         inline constexpr static std::size_t filter_order  = 32;
 
@@ -57,9 +227,36 @@ namespace cynth {
         static unsigned_t integral_time (T t)          { return static_cast<unsigned_t>(t / sample_length); } // Maybe signed?
 
         constexpr composite_function (const composite_function&) = default;
-        composite_function& operator = (const composite_function&) = default;
+        // Every assignment marks the node as changed (see revision()).
+        composite_function& operator = (const composite_function& other) {
+            this->operation_       = other.operation_;
+            this->first_ptr_       = other.first_ptr_;
+            this->second_ptr_      = other.second_ptr_;
+            this->func_ptr_        = other.func_ptr_;
+            this->source_ptr_      = other.source_ptr_;
+            this->param_ptr_       = other.param_ptr_;
+            this->first_identity_  = other.first_identity_;
+            this->second_identity_ = other.second_identity_;
+            this->first_constant_  = other.first_constant_;
+            this->second_constant_ = other.second_constant_;
+            this->cache_ptr_       = other.cache_ptr_;
+            this->control_rate_    = other.control_rate_;
+            this->param_revision_  = other.param_revision_;
+            this->revision_        = ++revision_clock;
+            return *this;
+        }
 
         constexpr composite_function (const func_t& func): func_ptr_{func} {}
+        constexpr composite_function (const function_source<T>& source): source_ptr_{&source} {}
+
+        // A value read at every evaluation, e.g. a parameter changed during playback or one voice's note.
+        // Unlike a constant, it's not folded by compiled_function. A polyphonic program reads the value
+        // of voice v at value + v * stride (see compiled_function lanes).
+        static composite_function parameter (const T& value) {
+            composite_function result{T{0}};
+            result.param_ptr_ = &value;
+            return result;
+        }
 
         // Two composite functions:
         constexpr composite_function (operation_enum operation, const composite_function& first, const composite_function& second):
@@ -232,12 +429,20 @@ namespace cynth {
 
         bool identity () const { return this->operation_ == CONSTANT && this->first_identity_ == true; }
 
+        // The wrapped function of a leaf node, nullptr otherwise.
+        func_ptr_t func_ptr () const { return this->func_ptr_; }
+
         T operator () (T in) const {
+            CYNTH_PROFILE_SCOPE(this->profile_, 1);
             if (this->cache_ptr_) {
                 return this->cache(in);
             }
             if (this->func_ptr_)
                 return (*this->func_ptr_)(in/*, func_ptr*/);
+            if (this->source_ptr_)
+                return (*this->source_ptr_)(in);
+            if (this->param_ptr_)
+                return *this->param_ptr_;
             switch (this->operation_) {
             case CONSTANT: default:
                 return this->first(in);
@@ -256,7 +461,27 @@ namespace cynth {
             }
         }
 
+        // Block evaluation:
+        // out[i] = (*this)(t0 + i * dt) for i in [0, n)
+        // The tree is traversed once per block instead of once per sample.
+        void render (T t0, T dt, T* out, std::size_t n) const {
+            block_t in;
+            for (std::size_t offset = 0; offset < n; offset += block_size) {
+                std::size_t count = std::min(block_size, n - offset);
+                for (std::size_t i = 0; i < count; ++i)
+                    in[i] = t0 + static_cast<T>(offset + i) * dt;
+                this->render_block(in.data(), out + offset, count);
+            }
+        }
+
+        // out[i] = (*this)(in[i]) for i in [0, n)
+        void render (const T* in, T* out, std::size_t n) const {
+            for (std::size_t offset = 0; offset < n; offset += block_size)
+                this->render_block(in + offset, out + offset, std::min(block_size, n - offset));
+        }
+
         T conv (T in) const {
+            CYNTH_PROFILE_TIMER(this->profile_.conv_cycles);
             T result = 0;
             for (std::size_t i = 0; i < filter_order; ++i) {
                 result += this->first(floating_time(i)) * this->second(in - floating_time(i));
@@ -268,8 +493,8 @@ namespace cynth {
         T cache (T in) const {
             if (!this->cache_ptr_)
                 throw cynth_exception{"Uninitialized function cache."};
-            std::size_t i = integral_time(fmod(in, this->cache_period_));
-            return (*this->cache_ptr_)[i];
+            CYNTH_PROFILE_COUNT(this->profile_.cache_hits, 1);
+            return (*this->cache_ptr_)(in);
         }
 
         T first  (T in) const {
@@ -287,24 +512,292 @@ namespace cynth {
             return this->second_constant_;
         }
 
-        void set_cache (T period, cache_t& cache) {
-            for (auto [i, t] = std::tuple<std::size_t, T>{0, 0}; i < cache_size && t < period; ++i, t += sample_length)
-                cache[i] = (*this)(t);
-            this->cache_period_ = period;
-            this->cache_ptr_    = &cache;
+        void render_first  (const T* in, T* out, std::size_t n) const {
+            if (this->first_ptr_)
+                return this->first_ptr_->render_block(in, out, n);
+            if (this->first_identity_)
+                return (void) std::copy(in, in + n, out);
+            std::fill(out, out + n, this->first_constant_);
+        }
+        void render_second (const T* in, T* out, std::size_t n) const {
+            if (this->second_ptr_)
+                return this->second_ptr_->render_block(in, out, n);
+            if (this->second_identity_)
+                return (void) std::copy(in, in + n, out);
+            std::fill(out, out + n, this->second_constant_);
+        }
+
+        // Samples one period of this function into the cache and evaluates from it from now on.
+        // The cache is sized from the period and the current sample rate.
+        // The function is pure, so the period may be split between several threads.
+        void set_cache (T period, cache_t& cache, interpolation_enum interpolation = LINEAR, std::size_t threads = 1) {
+            this->fill_cache(cache, period, interpolation, threads);
+            this->cache_ptr_ = &cache;
+        }
+
+        cache_t* cache () const { return this->cache_ptr_; } // nullptr without a cache.
+
+        // Marks this node as control-rate: In block evaluation, it's only evaluated at every `interval`-th
+        // sample (and the last one) and linearly interpolated in between. Meant for slowly varying
+        // pure functions of the time, e.g. LFOs and envelopes driving amp, freq or cutoff.
+        // Single-sample evaluation stays exact. 0 or 1 returns to audio rate.
+        void set_control_rate (std::size_t interval = default_control_interval) {
+            this->control_rate_ = interval;
+            this->revision_     = ++revision_clock;
+        }
+
+        std::size_t control_interval () const { return this->control_rate_; }
+
+        // Dependency tracking:
+        // Each assignment to a node stamps it with a new value of a global revision counter (revision_clock).
+        // Parameter nodes take a new revision when their value is found changed, sources report their own
+        // (see function_source::revision). A cache remembers the latest revision found in its subgraph
+        // when it was filled, so it is out of date once anything below it has changed since
+        // (e.g. osc.freq = 300) or the sample rate has changed.
+
+        unsigned_t revision () const { return this->revision_; }
+
+        // The latest revision of this node and all nodes below it. Shared nodes are walked once.
+        unsigned_t latest_revision () const {
+            revisions_t seen;
+            return this->latest_revision(seen);
+        }
+
+        bool cache_dirty () const {
+            revisions_t seen;
+            return this->cache_dirty(seen);
+        }
+
+        // Refills the out of date caches of this node and all nodes below it, deepest first,
+        // keeping their periods and interpolation. Returns the number of refilled caches.
+        // Meant to be called from a control thread, the audio thread keeps reading the old values until then.
+        std::size_t refresh_caches (std::size_t threads = 1) const {
+            revisions_t                                   seen;
+            std::unordered_set<const composite_function*> done;
+            return this->refresh_caches(threads, seen, done);
         }
 
+        // Brings every cache in this graph up to date using all cores.
+        // Each cache is filled in parallel, the caches themselves in dependency order.
+        std::size_t prepare_caches (std::size_t threads = parallel_tools::concurrency()) const {
+            return this->refresh_caches(threads);
+        }
+
+        #ifdef CYNTH_PROFILE
+        // Prints the profile of this node and all nodes below it, ranked by the cycles spent in each node itself.
+        // Every node appears once, its children are referred to by their ids.
+        void profile_report (std::ostream& out) const {
+            std::vector<const composite_function*> nodes;
+            this->collect(nodes);
+            auto id = [&] (const composite_function* node) {
+                return std::to_string(std::find(nodes.begin(), nodes.end(), node) - nodes.begin());
+            };
+            auto operand = [&] (const composite_function* ptr, bool identity, T constant) {
+                return ptr ? "#" + id(ptr) : identity ? std::string{"t"} : std::to_string(constant);
+            };
+            static const char* operations[] = {"CONSTANT", "ADD", "SUB", "MULT", "DIV", "COMP", "CONV"};
+
+            std::vector<profiling::report_row> rows;
+            for (std::size_t i = 0; i < nodes.size(); ++i) {
+                auto& node = *nodes[i];
+                std::string description;
+                if (node.func_ptr_)
+                    description = "func";
+                else if (node.source_ptr_)
+                    description = "source";
+                else if (node.param_ptr_)
+                    description = "param";
+                else if (node.operation_ == CONSTANT)
+                    description = operand(node.first_ptr_, node.first_identity_, node.first_constant_);
+                else
+                    description = std::string{operations[node.operation_]} + " "
+                        + operand(node.first_ptr_,  node.first_identity_,  node.first_constant_)  + " "
+                        + operand(node.second_ptr_, node.second_identity_, node.second_constant_);
+                if (node.cache_ptr_)
+                    description = "cache of " + description;
+                if (node.control_rate_ > 1)
+                    description += " @" + std::to_string(node.control_rate_);
+                auto& p = node.profile_;
+                rows.push_back({i, description, p.evaluations.get(), p.samples.get(), p.self_cycles.get(), p.cycles.get(), p.cache_hits.get(), p.cache_misses.get(), p.conv_cycles.get()});
+            }
+            profiling::print_report(std::move(rows), out);
+        }
+
+        void reset_profile () const {
+            std::vector<const composite_function*> nodes;
+            this->collect(nodes);
+            for (auto node: nodes)
+                node->profile_.reset();
+        }
+        #endif
+
     private:
+        template <typename> friend class compiled_function;
+
+        using revisions_t = std::unordered_map<const composite_function*, unsigned_t>;
+
+        // Each node shared by several parents is walked once.
+        unsigned_t latest_revision (revisions_t& seen) const {
+            auto found = seen.find(this);
+            if (found != seen.end())
+                return found->second;
+            auto result = this->revision_;
+            if (this->first_ptr_)
+                result = std::max(result, this->first_ptr_->latest_revision(seen));
+            if (this->second_ptr_)
+                result = std::max(result, this->second_ptr_->latest_revision(seen));
+            if (this->param_ptr_)
+                result = std::max(result, this->param_revision_(*this->param_ptr_));
+            if (this->source_ptr_)
+                result = std::max(result, this->source_ptr_->revision());
+            seen.emplace(this, result);
+            return result;
+        }
+
+        bool cache_dirty (revisions_t& seen) const {
+            return this->cache_ptr_ && (this->latest_revision(seen) > this->cache_ptr_->revision() || this->cache_ptr_->sample_rate() != sample_rate);
+        }
+
+        std::size_t refresh_caches (std::size_t threads, revisions_t& seen, std::unordered_set<const composite_function*>& done) const {
+            if (!done.insert(this).second)
+                return 0;
+            std::size_t count = 0;
+            if (this->first_ptr_)
+                count += this->first_ptr_->refresh_caches(threads, seen, done);
+            if (this->second_ptr_)
+                count += this->second_ptr_->refresh_caches(threads, seen, done);
+            if (this->cache_dirty(seen)) {
+                this->fill_cache(*this->cache_ptr_, this->cache_ptr_->period(), this->cache_ptr_->interpolation(), threads);
+                ++count;
+            }
+            return count;
+        }
+
+        #ifdef CYNTH_PROFILE
+        // This node and the ones below it, each once, parents first.
+        void collect (std::vector<const composite_function*>& nodes) const {
+            if (std::find(nodes.begin(), nodes.end(), this) != nodes.end())
+                return;
+            nodes.push_back(this);
+            if (this->first_ptr_)
+                this->first_ptr_->collect(nodes);
+            if (this->second_ptr_)
+                this->second_ptr_->collect(nodes);
+        }
+        #endif
+
+        // Samples the node itself, not its current cache.
+        // The samples are split between the threads in whole blocks.
+        void fill_cache (cache_t& cache, T period, interpolation_enum interpolation, std::size_t threads) const {
+            CYNTH_PROFILE_COUNT(this->profile_.cache_misses, 1);
+            cache.fill(period, sample_rate, interpolation, this->latest_revision(), [this, threads] (const T* in, T* out, std::size_t n) {
+                parallel_tools::parallel_for((n + block_size - 1) / block_size, threads, [&] (std::size_t begin, std::size_t end) {
+                    for (std::size_t offset = begin * block_size; offset < std::min(end * block_size, n); offset += block_size)
+                        this->render_node(in + offset, out + offset, std::min(block_size, n - offset));
+                });
+            });
+        }
+
+        // Expects n <= block_size.
+        void render_block (const T* in, T* out, std::size_t n) const {
+            CYNTH_PROFILE_SCOPE(this->profile_, n);
+            if (this->cache_ptr_) {
+                CYNTH_PROFILE_COUNT(this->profile_.cache_hits, n);
+                return this->cache_ptr_->render(in, out, n);
+            }
+            if (this->control_rate_ > 1)
+                return this->render_control(in, out, n);
+            this->render_node(in, out, n);
+        }
+
+        // Evaluates the node at every control_rate_-th input and the last one. Expects n <= block_size.
+        void render_control (const T* in, T* out, std::size_t n) const {
+            if (!n)
+                return;
+            auto        interval = this->control_rate_;
+            std::size_t count    = 0;
+            block_t     points, values;
+            for (std::size_t i = 0; i < n; i += interval)
+                points[count++] = in[i];
+            if ((n - 1) % interval)
+                points[count++] = in[n - 1];
+            this->render_node(points.data(), values.data(), count);
+
+            for (std::size_t k = 0; k + 1 < count; ++k) {
+                auto begin = k * interval;
+                auto end   = std::min(begin + interval, n - 1);
+                auto step  = (values[k + 1] - values[k]) / static_cast<T>(end - begin);
+                for (auto i = begin; i < end; ++i)
+                    out[i] = values[k] + step * static_cast<T>(i - begin);
+            }
+            out[n - 1] = values[count - 1];
+        }
+
+        // Bypasses the cache of this node. Expects n <= block_size.
+        void render_node (const T* in, T* out, std::size_t n) const {
+            if (this->func_ptr_) {
+                for (std::size_t i = 0; i < n; ++i)
+                    out[i] = (*this->func_ptr_)(in[i]);
+                return;
+            }
+            if (this->source_ptr_)
+                return this->source_ptr_->render(in, out, n);
+            if (this->param_ptr_)
+                return (void) std::fill(out, out + n, *this->param_ptr_);
+            block_t other;
+            switch (this->operation_) {
+            case CONSTANT: default:
+                this->render_first(in, out, n);
+                return;
+            case ADD:
+                this->render_first(in, out, n);
+                this->render_second(in, other.data(), n);
+                simd_tools::add(out, other.data(), out, n);
+                return;
+            case SUB:
+                this->render_first(in, out, n);
+                this->render_second(in, other.data(), n);
+                simd_tools::sub(out, other.data(), out, n);
+                return;
+            case MULT:
+                this->render_first(in, out, n);
+                this->render_second(in, other.data(), n);
+                simd_tools::mult(out, other.data(), out, n);
+                return;
+            case DIV:
+                this->render_first(in, out, n);
+                this->render_second(in, other.data(), n);
+                simd_tools::div(out, other.data(), out, n);
+                return;
+            case COMP:
+                this->render_second(in, other.data(), n);
+                this->render_first(other.data(), out, n);
+                return;
+            case CONV:
+                for (std::size_t i = 0; i < n; ++i)
+                    out[i] = this->conv(in[i]);
+                return;
+            }
+        }
+
         operation_enum            operation_       = CONSTANT;
         const composite_function* first_ptr_       = nullptr;
         const composite_function* second_ptr_      = nullptr;
         func_ptr_t                func_ptr_        = nullptr;
+        const function_source<T>* source_ptr_      = nullptr;
+        const T*                  param_ptr_       = nullptr;
         bool                      first_identity_  = false;
         bool                      second_identity_ = false;
         T                         first_constant_  = 0;
         T                         second_constant_ = 0;
         cache_t*                  cache_ptr_       = nullptr;
-        T                         cache_period_    = 0;
+        std::size_t               control_rate_    = 0; // Samples between evaluations, 0 = audio rate.
+        unsigned_t                revision_        = 0;
+        value_revision<T>         param_revision_;
+
+        #ifdef CYNTH_PROFILE
+        mutable profiling::node_profile profile_;
+        #endif
     };
 
     // Identity function can be used to declare the input variable:
@@ -336,24 +829,86 @@ namespace cynth {
                 + 0.08 * math::cos((4 * constants::pi * t) / (wave_function::floating_time(wave_function::filter_order - 1)));
         } }};
 
-        inline constexpr static wave_function saw  = {wave_function_wrapper{ [] (floating_t t) -> floating_t {
-            t = t < 0
-                ? 2*constants::pi - std::fmod(std::abs(t), 2*constants::pi)
-                : std::fmod(t, 2*constants::pi);
-            return (1/constants::pi) * t - 1;
-        } }};
+        inline constexpr static wave_function saw  = {wave_function_wrapper{ [] (floating_t t) -> floating_t { return math::saw(t);} }};
     };
 
-    template <std::size_t SIZE>
-    class function_holder {
-    protected:
-        wave_function& f (wave_function&& temp) {
-            if (holder_last_ >= SIZE)
-                throw cynth_exception{"No more space for intermediate functions."};
-            return this->holder_[holder_last_++] = std::move(temp);
+    // Owns the intermediate nodes of a patch.
+    // Nodes are placed one after another in chunks, in the order they are made. Since the
+    // children of a node are made before it, this is also the order of evaluation.
+    // Chunks never move, so the nodes may be referenced by the graph. When a chunk is full,
+    // a new one twice as large is added, so there is no limit on the number of nodes.
+    // Nodes are trivially destructible, so they are all released at once without visiting them.
+    template <typename T>
+    class graph_arena {
+    public:
+        using function_t = composite_function<T>;
+
+        static_assert(std::is_trivially_destructible_v<function_t>);
+
+        graph_arena (std::size_t chunk_size = 16): chunk_size_{std::max<std::size_t>(1, chunk_size)} {}
+
+        graph_arena (const graph_arena&) = delete;
+        graph_arena& operator = (const graph_arena&) = delete;
+        graph_arena (graph_arena&&) = default;
+        graph_arena& operator = (graph_arena&&) = default;
+
+        // Stores a node and returns a reference to it, valid until the arena is cleared or destroyed.
+        function_t& make (const function_t& node) {
+            if (this->chunk_ == this->chunks_.size() || this->used_ == this->chunks_[this->chunk_].size) {
+                if (this->chunk_ < this->chunks_.size())
+                    ++this->chunk_;
+                if (this->chunk_ == this->chunks_.size()) {
+                    std::size_t size = this->chunks_.empty() ? this->chunk_size_ : 2 * this->chunks_.back().size;
+                    this->chunks_.push_back({std::make_unique<slot_t[]>(size), size});
+                }
+                this->used_ = 0;
+            }
+            ++this->size_;
+            return *new (&this->chunks_[this->chunk_].slots[this->used_++]) function_t{node};
+        }
+
+        function_t& operator() (const function_t& node) { return this->make(node); }
+
+        std::size_t size () const { return this->size_; }
+
+        // Releases all nodes at once. The memory is kept for reuse.
+        void clear () {
+            this->chunk_ = 0;
+            this->used_  = 0;
+            this->size_  = 0;
         }
 
-        std::size_t holder_last_ = 0;
-        std::array<wave_function, SIZE> holder_;
+    private:
+        struct slot_t { alignas(function_t) unsigned char bytes[sizeof(function_t)]; };
+
+        struct chunk_t {
+            std::unique_ptr<slot_t[]> slots;
+            std::size_t               size;
+        };
+
+        std::vector<chunk_t> chunks_;
+        std::size_t          chunk_size_;
+        std::size_t          chunk_ = 0; // The chunk being filled.
+        std::size_t          used_  = 0; // Slots used in it.
+        std::size_t          size_  = 0;
+    };
+
+    using wave_arena = graph_arena<floating_t>;
+
+    // Base of devices building their graph from intermediate functions.
+    // The intermediate functions go to the arena given to the device (e.g. one shared by the whole patch),
+    // or to a private one by default. Either way, the device references them, so it cannot be copied.
+    class arena_holder {
+    protected:
+        arena_holder (wave_arena* arena = nullptr): arena_{arena ? arena : &this->own_arena_} {}
+
+        arena_holder (const arena_holder&) = delete;
+        arena_holder& operator = (const arena_holder&) = delete;
+
+        wave_function& f (const wave_function& temp) { return this->arena_->make(temp); }
+
+    private:
+        wave_arena  own_arena_;
+        wave_arena* arena_;
     };
 }
\ No newline at end of file
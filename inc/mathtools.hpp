@@ -1,5 +1,12 @@
 #pragma once
 
+#include "config.hpp"
+
+#include <cstddef>
+#include <complex>
+#include <vector>
+#include <cmath>
+
 namespace cynth::math_tools {
 
     /*template <std::size_t FROM, std::size_t TO, std::size_t STEP, typename T, std::size_t SIZE>
@@ -29,36 +36,75 @@ namespace cynth::math_tools {
         for (auto [i, t] = std::tuple{std::size_t{0}, from}; i < SIZE && t < to; ++i, t += spacing)
             result[i] = {func(t), 0};
         return result;
-    }
+    }*/
 
-    template <typename T, std::size_t SIZE>
-    void fft (std::array<std::complex<T>, SIZE>& x) {
-        // Slower recursive algorithm.
-        // TODO: Cooley–Tukey algorithm
-        constexpr std::size_t n = SIZE;
-        if constexpr (n >= 2) {
-            auto even = slice<0, n, 2>(x); // std::array<complex, n/4>
-            auto odd  = slice<1, n, 2>(x); // std::array<complex, (n/2-1)/2>
-        
-            fft(even);
-            fft(odd);
+    // Iterative radix-2 Cooley-Tukey FFT.
+    // The twiddle factors and the bit reversal permutation are computed once per size.
+    template <typename T>
+    class fft {
+    public:
+        using complex_t = std::complex<T>;
+
+        // The size must be a power of two.
+        fft (std::size_t size):
+            size_     {size},
+            twiddles_ (size / 2),
+            reversed_ (size) {
+
+            const double pi = std::acos(-1.0);
+            for (std::size_t k = 0; k < size / 2; ++k)
+                this->twiddles_[k] = std::polar<double>(1.0, -2 * pi * k / size);
 
-            for (std::size_t i = 0; i < n/2; ++i) {
-                complex c = std::polar(1.0, -2 * constants::pi * i / n) * odd[i];
-                x[i]     = even[i] + c;
-                x[i+n/2] = even[i] - c;
+            std::size_t bits = 0;
+            while ((std::size_t{1} << bits) < size)
+                ++bits;
+            for (std::size_t i = 0; i < size; ++i) {
+                std::size_t r = 0;
+                for (std::size_t b = 0; b < bits; ++b)
+                    r |= ((i >> b) & 1) << (bits - b - 1);
+                this->reversed_[i] = r;
             }
         }
-    }
 
-    template <typename T, std::size_t SIZE>
-    void inverse_fft (std::array<complex, SIZE>& x) {
-        for (auto&& c: x)
-            c = std::conj(c);
-        fft(x);
-        double n = static_cast<T>(SIZE);
-        for (auto&& c: x)
-            c = std::conj(c)/n;
-    }*/
+        std::size_t size () const { return this->size_; }
+
+        void forward (complex_t* x) const { this->transform(x, false); }
+
+        // Including the 1/n scaling.
+        void inverse (complex_t* x) const {
+            this->transform(x, true);
+            T scale = T{1} / static_cast<T>(this->size_);
+            for (std::size_t i = 0; i < this->size_; ++i)
+                x[i] *= scale;
+        }
+
+    private:
+        void transform (complex_t* x, bool inverse) const {
+            auto n = this->size_;
+            for (std::size_t i = 0; i < n; ++i)
+                if (i < this->reversed_[i])
+                    std::swap(x[i], x[this->reversed_[i]]);
+
+            for (std::size_t length = 2; length <= n; length *= 2) {
+                std::size_t half   = length / 2;
+                std::size_t stride = n / length;
+                for (std::size_t start = 0; start < n; start += length) {
+                    for (std::size_t k = 0; k < half; ++k) {
+                        auto w = this->twiddles_[k * stride];
+                        if (inverse)
+                            w = std::conj(w);
+                        auto even = x[start + k];
+                        auto odd  = x[start + k + half] * w;
+                        x[start + k]        = even + odd;
+                        x[start + k + half] = even - odd;
+                    }
+                }
+            }
+        }
+
+        std::size_t              size_;
+        std::vector<complex_t>   twiddles_;
+        std::vector<std::size_t> reversed_;
+    };
 
 }
\ No newline at end of file
@@ -0,0 +1,473 @@
+#pragma once
+
+#include "exceptions.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cassert>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace cynth::parallel_tools {
+
+    std::size_t concurrency () {
+        auto count = std::thread::hardware_concurrency();
+        return count ? count : 1;
+    }
+
+    // Calls func(begin, end) on contiguous ranges covering [0, count), each on its own thread.
+    // At most `threads` ranges are made, the first one runs on the calling thread.
+    // An exception thrown by any of the calls is rethrown here once all of them have finished.
+    template <typename Func>
+    void parallel_for (std::size_t count, std::size_t threads, Func func) {
+        threads = std::max<std::size_t>(1, std::min(threads, count));
+        if (threads == 1) {
+            if (count)
+                func(std::size_t{0}, count);
+            return;
+        }
+
+        std::vector<std::exception_ptr> errors(threads);
+        auto run = [&] (std::size_t part) {
+            try {
+                func(count * part / threads, count * (part + 1) / threads);
+            } catch (...) {
+                errors[part] = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (std::size_t part = 1; part < threads; ++part)
+            workers.emplace_back(run, part);
+        run(0);
+        for (auto& worker: workers)
+            worker.join();
+
+        for (auto& error: errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+
+    // Hint to the processor that this is a spin-wait loop.
+    inline void pause () {
+        #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+        #elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_ia32_pause();
+        #elif defined(__GNUC__) && defined(__aarch64__)
+        asm volatile ("yield");
+        #endif
+    }
+
+    // Hazard pointers of the rcu_slots: Every thread announces the values it is reading in a record of its own.
+    // A thread takes a record at its first read (or at attach()) and gives it back when it exits.
+    // Taking a new record allocates, so real-time threads claim theirs before they render:
+    // attach() on the thread itself, or reserve() for threads created by others (e.g. the ASIO callback),
+    // whose first read then only takes a reserved record.
+    // Records are never freed, so that publishers can walk the list at any time.
+    class hazards {
+    public:
+        // Reads nested in each other on one thread (e.g. a cache read while rendering a program):
+        inline constexpr static std::size_t depth = 4;
+
+        // Claims the record of the calling thread ahead of its first read.
+        static void attach () {
+            local();
+        }
+
+        // Makes sure `count` records are free for threads yet to read.
+        static void reserve (std::size_t count) {
+            for (auto record = head_.load(std::memory_order_acquire); record && count; record = record->next)
+                if (!record->owned.load(std::memory_order_relaxed))
+                    --count;
+            for (; count; --count)
+                link(new record);
+        }
+
+        // The next free hazard of the calling thread. Nesting deeper than `depth` is a bug of the caller.
+        static std::atomic<const void*>& push () {
+            auto& record = local();
+            assert(record.used < depth && "Too many nested rcu_slot reads.");
+            return record.values[record.used++];
+        }
+
+        static void pop () {
+            auto& record = local();
+            record.values[--record.used].store(nullptr, std::memory_order_release);
+        }
+
+        // Whether any thread is reading the value.
+        static bool in_use (const void* value) {
+            for (auto record = head_.load(std::memory_order_acquire); record; record = record->next)
+                for (auto& hazard: record->values)
+                    if (hazard.load(std::memory_order_seq_cst) == value)
+                        return true;
+            return false;
+        }
+
+    private:
+        struct record {
+            std::atomic<const void*> values[depth] = {};
+            std::atomic<bool>        owned {false};
+            record*                  next = nullptr;
+            std::size_t              used = 0; // Only used by the owner.
+        };
+
+        struct owner {
+            record* value = acquire();
+            ~owner () { this->value->owned.store(false, std::memory_order_release); }
+        };
+
+        static record& local () {
+            thread_local owner current;
+            return *current.value;
+        }
+
+        static record* acquire () {
+            for (auto record = head_.load(std::memory_order_acquire); record; record = record->next) {
+                bool expected = false;
+                if (!record->owned.load(std::memory_order_relaxed) && record->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                    return record;
+            }
+            auto result = new record;
+            result->owned.store(true, std::memory_order_relaxed);
+            link(result);
+            return result;
+        }
+
+        static void link (record* value) {
+            value->next = head_.load(std::memory_order_relaxed);
+            while (!head_.compare_exchange_weak(value->next, value, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        inline static std::atomic<record*> head_ {nullptr};
+    };
+
+    // Tasks with dependencies: Task i may start once dependencies[i] other tasks have finished.
+    // Its successors are successors[successor_begin[i]] ... successors[successor_begin[i + 1]].
+    struct task_graph {
+        std::vector<std::uint32_t> dependencies;
+        std::vector<std::uint32_t> successor_begin;
+        std::vector<std::uint32_t> successors;
+
+        std::size_t size () const { return this->dependencies.size(); }
+    };
+
+    // A pool of pre-spawned threads running task graphs, meant for the audio thread:
+    // The calling thread takes part in the work, ready tasks go to the queue of the thread
+    // that released them, idle threads steal from the other queues. All the memory is allocated
+    // in the constructor, so a run never allocates (unless a task throws).
+    // Between runs, the workers spin for a while (so that consecutive blocks start without
+    // a wakeup) and only then go to sleep. Waking them up is the only time the caller takes a lock.
+    // Only one thread may run graphs on a pool at a time and tasks may not run graphs on it.
+    class worker_pool {
+    public:
+        inline constexpr static std::size_t spin_count = 1 << 14;
+
+        // `threads` including the caller, `capacity` is the maximum number of tasks in a graph.
+        worker_pool (std::size_t threads = concurrency(), std::size_t capacity = 1024):
+            size_     {std::max<std::size_t>(1, threads)},
+            capacity_ {capacity},
+            queues_   {new queue_t[this->size_]},
+            pending_  {new std::atomic<std::uint32_t>[capacity]} {
+
+            for (std::size_t q = 0; q < this->size_; ++q)
+                this->queues_[q].items.reset(new std::uint32_t[capacity]);
+            this->threads_.reserve(this->size_ - 1);
+            for (std::size_t q = 1; q < this->size_; ++q)
+                this->threads_.emplace_back([this, q] { this->worker(q); });
+        }
+
+        worker_pool (const worker_pool&) = delete;
+        worker_pool& operator = (const worker_pool&) = delete;
+
+        ~worker_pool () {
+            {
+                std::lock_guard<std::mutex> lock{this->mutex_};
+                this->stop_.store(true);
+            }
+            this->wake_.notify_all();
+            for (auto& thread: this->threads_)
+                thread.join();
+        }
+
+        std::size_t size     () const { return this->size_; }
+        std::size_t capacity () const { return this->capacity_; }
+
+        // Calls func(task) for every task of the graph and returns once all of them have finished.
+        // An exception thrown by a task is rethrown here, the other tasks still run.
+        template <typename Func>
+        void run (const task_graph& graph, Func& func) {
+            auto count = graph.size();
+            if (count > this->capacity_)
+                throw cynth_exception{"Task graph exceeds the capacity of the worker pool."};
+            if (!count)
+                return;
+
+            this->graph_   = &graph;
+            this->context_ = &func;
+            this->call_    = [] (void* context, std::uint32_t task) { (*static_cast<Func*>(context))(task); };
+            this->error_   = nullptr;
+            for (std::size_t task = 0; task < count; ++task)
+                this->pending_[task].store(graph.dependencies[task], std::memory_order_relaxed);
+            // A worker still leaving the previous run may take a task as soon as it's queued:
+            this->remaining_.store(count, std::memory_order_release);
+            for (std::size_t task = 0; task < count; ++task)
+                if (!graph.dependencies[task])
+                    this->push(0, static_cast<std::uint32_t>(task));
+
+            this->epoch_.fetch_add(1);
+            if (this->sleeping_.load()) {
+                std::lock_guard<std::mutex> lock{this->mutex_};
+                this->wake_.notify_all();
+            }
+
+            this->work(0);
+            if (this->error_)
+                std::rethrow_exception(std::exchange(this->error_, nullptr));
+        }
+
+    private:
+        // Owner pushes and pops at the tail, thieves take from the head.
+        // Counters only grow, the items are stored at counter % capacity.
+        struct alignas(64) queue_t {
+            std::atomic_flag                 lock = ATOMIC_FLAG_INIT;
+            std::unique_ptr<std::uint32_t[]> items;
+            std::size_t                      head = 0;
+            std::size_t                      tail = 0;
+        };
+
+        static void lock   (queue_t& queue) { while (queue.lock.test_and_set(std::memory_order_acquire)) pause(); }
+        static void unlock (queue_t& queue) { queue.lock.clear(std::memory_order_release); }
+
+        void push (std::size_t q, std::uint32_t task) {
+            auto& queue = this->queues_[q];
+            lock(queue);
+            queue.items[queue.tail++ % this->capacity_] = task;
+            unlock(queue);
+        }
+
+        bool pop (std::size_t q, std::uint32_t& task) {
+            auto& queue = this->queues_[q];
+            lock(queue);
+            bool found = queue.head != queue.tail;
+            if (found)
+                task = queue.items[--queue.tail % this->capacity_];
+            unlock(queue);
+            return found;
+        }
+
+        bool steal (std::size_t self, std::uint32_t& task) {
+            for (std::size_t k = 1; k < this->size_; ++k) {
+                auto& queue = this->queues_[(self + k) % this->size_];
+                lock(queue);
+                bool found = queue.head != queue.tail;
+                if (found)
+                    task = queue.items[queue.head++ % this->capacity_];
+                unlock(queue);
+                if (found)
+                    return true;
+            }
+            return false;
+        }
+
+        // Runs tasks until the whole graph has finished.
+        // Long waits give way to other threads, in case the one holding the work was preempted.
+        void work (std::size_t self) {
+            std::uint32_t task;
+            std::size_t   spin = 0;
+            while (this->remaining_.load(std::memory_order_acquire)) {
+                if (this->pop(self, task) || this->steal(self, task)) {
+                    this->execute(self, task);
+                    spin = 0;
+                } else if (++spin < spin_count) {
+                    pause();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void execute (std::size_t self, std::uint32_t task) {
+            try {
+                this->call_(this->context_, task);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock{this->error_mutex_};
+                if (!this->error_)
+                    this->error_ = std::current_exception();
+            }
+            auto& graph = *this->graph_;
+            for (auto s = graph.successor_begin[task]; s < graph.successor_begin[task + 1]; ++s)
+                if (this->pending_[graph.successors[s]].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    this->push(self, graph.successors[s]);
+            // Successors are queued before the count drops, so it never reaches zero early.
+            this->remaining_.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        void worker (std::size_t self) {
+            hazards::attach();
+            std::uint64_t seen = 0;
+            while (true) {
+                std::size_t spin = 0;
+                while (this->epoch_.load() == seen && !this->stop_.load()) {
+                    if (++spin < spin_count) {
+                        pause();
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock{this->mutex_};
+                    this->sleeping_.fetch_add(1);
+                    this->wake_.wait(lock, [&] { return this->epoch_.load() != seen || this->stop_.load(); });
+                    this->sleeping_.fetch_sub(1);
+                }
+                if (this->stop_.load())
+                    return;
+                seen = this->epoch_.load();
+                this->work(self);
+            }
+        }
+
+        std::size_t                                 size_;
+        std::size_t                                 capacity_;
+        std::unique_ptr<queue_t[]>                  queues_;  // Queue 0 belongs to the calling thread.
+        std::unique_ptr<std::atomic<std::uint32_t>[]> pending_; // Unfinished dependencies per task.
+        std::vector<std::thread>                    threads_;
+
+        // The current run:
+        const task_graph*                           graph_   = nullptr;
+        void*                                       context_ = nullptr;
+        void                                        (*call_) (void*, std::uint32_t) = nullptr;
+        std::atomic<std::size_t>                    remaining_{0};
+        std::exception_ptr                          error_;
+        std::mutex                                  error_mutex_;
+
+        // Waking up:
+        std::atomic<std::uint64_t>                  epoch_{0};
+        std::atomic<std::size_t>                    sleeping_{0};
+        std::atomic<bool>                           stop_{false};
+        std::mutex                                  mutex_;
+        std::condition_variable                     wake_;
+    };
+
+    // Hands values from control threads to reader threads (read-copy-update).
+    // A reader brackets every use of the value by read() and done() (or holds a reader) and never waits:
+    // read() only retries if a value is published in between. publish() swaps the new value in
+    // and destroys the replaced one once no thread reads it any more, so a reader never
+    // sees a partially built value or a destroyed one and never pays for a destruction.
+    template <typename T>
+    class rcu_slot {
+    public:
+        rcu_slot () = default;
+        rcu_slot (const rcu_slot&) = delete;
+        rcu_slot& operator = (const rcu_slot&) = delete;
+
+        ~rcu_slot () { delete this->current_.load(std::memory_order_relaxed); }
+
+        // The current value (null before the first publish), valid until done().
+        // Reads on one thread may nest (up to hazards::depth), done() ends the latest one.
+        T* read () const {
+            auto& hazard = hazards::push();
+            T*    value  = this->current_.load(std::memory_order_relaxed);
+            while (true) {
+                // Announced before checking, so that publish() either sees the announcement or the reader sees the new value:
+                hazard.store(value, std::memory_order_seq_cst);
+                T* check = this->current_.load(std::memory_order_seq_cst);
+                if (check == value)
+                    return value;
+                value = check;
+            }
+        }
+
+        void done () const {
+            hazards::pop();
+        }
+
+        // A read() for the lifetime of the reader.
+        class reader {
+        public:
+            reader (const rcu_slot& slot): slot_{slot}, value_{slot.read()} {}
+            ~reader () { this->slot_.done(); }
+
+            reader (const reader&) = delete;
+            reader& operator = (const reader&) = delete;
+
+            T* get        () const { return this->value_; }
+            T* operator-> () const { return this->value_; }
+            T& operator*  () const { return *this->value_; }
+            explicit operator bool () const { return this->value_; }
+
+        private:
+            const rcu_slot& slot_;
+            T*              value_;
+        };
+
+        bool empty () const { return !this->current_.load(std::memory_order_acquire); }
+
+        // Waits (on the calling thread) for the readers of the replaced value to finish.
+        void publish (std::unique_ptr<T> value) {
+            std::lock_guard<std::mutex> guard{this->publish_mutex_};
+            T* old = this->current_.exchange(value.release(), std::memory_order_seq_cst);
+            while (old && hazards::in_use(old))
+                std::this_thread::yield();
+            delete old;
+        }
+
+    private:
+        std::atomic<T*> current_ {nullptr};
+        std::mutex      publish_mutex_; // Only between publishers.
+    };
+
+    // Wait-free queue from one producer thread to one consumer thread.
+    // The storage is allocated in the constructor, push() fails when the queue is full.
+    template <typename T>
+    class spsc_queue {
+    public:
+        spsc_queue (std::size_t capacity): items_(capacity + 1) {}
+
+        spsc_queue (const spsc_queue&) = delete;
+        spsc_queue& operator = (const spsc_queue&) = delete;
+
+        // Producer:
+        bool push (const T& item) {
+            auto tail = this->tail_.load(std::memory_order_relaxed);
+            auto next = this->advance(tail);
+            if (next == this->head_.load(std::memory_order_acquire))
+                return false;
+            this->items_[tail] = item;
+            this->tail_.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer: The oldest item, valid until pop(), or null when empty.
+        const T* front () const {
+            auto head = this->head_.load(std::memory_order_relaxed);
+            if (head == this->tail_.load(std::memory_order_acquire))
+                return nullptr;
+            return &this->items_[head];
+        }
+
+        void pop () {
+            auto head = this->head_.load(std::memory_order_relaxed);
+            this->head_.store(this->advance(head), std::memory_order_release);
+        }
+
+    private:
+        std::size_t advance (std::size_t i) const { return i + 1 == this->items_.size() ? 0 : i + 1; }
+
+        std::vector<T>                       items_;
+        alignas(64) std::atomic<std::size_t> head_ {0}; // Written by the consumer.
+        alignas(64) std::atomic<std::size_t> tail_ {0}; // Written by the producer.
+    };
+
+}
@@ -1,4 +1,17 @@
 #pragma once
 
+#if defined(_WIN32)
 #define CYNTH_OS_WINDOWS
-#define CYNTH_API_ASIO
\ No newline at end of file
+#elif defined(__linux__)
+#define CYNTH_OS_LINUX
+#endif
+
+// ASIO is the audio API on Windows. Elsewhere it may be enabled by the build (e.g. to benchmark the sample conversion).
+#if defined(CYNTH_OS_WINDOWS) && !defined(CYNTH_API_ASIO)
+#define CYNTH_API_ASIO
+#endif
+
+// Without a sound card API, the headless backend renders on a clock of its own.
+#if !defined(CYNTH_OS_WINDOWS) && !defined(CYNTH_API_NULL)
+#define CYNTH_API_NULL
+#endif
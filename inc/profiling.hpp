@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+/*
+
+Opt-in instrumentation of the function graph evaluation.
+
+Built with CYNTH_PROFILE defined, every composite_function node counts its evaluations and evaluated samples
+and accumulates the processor cycles spent in it, both inclusive and exclusive of the nodes below it.
+Cached nodes count their lookups (hits) and refills (misses), convolutions the cycles spent in conv().
+compiled_function counts cycles per instruction. Both can print a report ranked by cost.
+
+Without CYNTH_PROFILE, none of the counters exist and the scope macros expand to nothing.
+
+*/
+
+namespace cynth::profiling {
+
+    // Time stamp counter, or nanoseconds where there is none.
+    inline std::uint64_t cycles () {
+        #if defined(_MSC_VER) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+        return __rdtsc();
+        #else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        #endif
+    }
+
+    // A relaxed atomic counter. A copied node is a different node, so copies start from zero.
+    class counter {
+    public:
+        constexpr counter () = default;
+        constexpr counter (const counter&): value_{0} {}
+        counter& operator = (const counter&) { return *this; }
+
+        void          add   (std::uint64_t n) { this->value_.fetch_add(n, std::memory_order_relaxed); }
+        void          reset ()                { this->value_.store(0, std::memory_order_relaxed); }
+        std::uint64_t get   () const          { return this->value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint64_t> value_ {0};
+    };
+
+    struct node_profile {
+        counter evaluations;  // Calls (single samples or blocks).
+        counter samples;      // Evaluated samples.
+        counter cycles;       // Including the nodes below.
+        counter self_cycles;  // Excluding the nodes below.
+        counter cache_hits;   // Samples read from the cache.
+        counter cache_misses; // Refills of the cache.
+        counter conv_cycles;  // Spent in conv().
+
+        void reset () {
+            for (auto c: {&evaluations, &samples, &cycles, &self_cycles, &cache_hits, &cache_misses, &conv_cycles})
+                c->reset();
+        }
+    };
+
+    // Measures one evaluation of a node. Nested scopes on the same thread are subtracted
+    // from the self cycles of the enclosing one.
+    class scope {
+    public:
+        scope (node_profile& profile, std::size_t samples):
+            profile_ {profile},
+            outer_   {current_},
+            start_   {cycles()} {
+
+            profile.evaluations.add(1);
+            profile.samples.add(samples);
+            current_ = &this->children_;
+        }
+
+        scope (const scope&) = delete;
+        scope& operator = (const scope&) = delete;
+
+        ~scope () {
+            auto elapsed = cycles() - this->start_;
+            this->profile_.cycles.add(elapsed);
+            this->profile_.self_cycles.add(elapsed - std::min(elapsed, this->children_));
+            current_ = this->outer_;
+            if (this->outer_)
+                *this->outer_ += elapsed;
+        }
+
+    private:
+        inline static thread_local std::uint64_t* current_ = nullptr;
+
+        node_profile&  profile_;
+        std::uint64_t* outer_;
+        std::uint64_t  start_;
+        std::uint64_t  children_ = 0;
+    };
+
+    // Adds the cycles spent in its lifetime to a counter.
+    class timer {
+    public:
+        timer (counter& target): target_{target}, start_{cycles()} {}
+
+        timer (const timer&) = delete;
+        timer& operator = (const timer&) = delete;
+
+        ~timer () { this->target_.add(cycles() - this->start_); }
+
+    private:
+        counter&      target_;
+        std::uint64_t start_;
+    };
+
+    // One line of a report:
+    struct report_row {
+        std::size_t   id;
+        std::string   description; // Kind of the node and its children, e.g. "ADD #3 #4"
+        std::uint64_t evaluations;
+        std::uint64_t samples;
+        std::uint64_t self_cycles;
+        std::uint64_t cycles;
+        std::uint64_t cache_hits;
+        std::uint64_t cache_misses;
+        std::uint64_t conv_cycles;
+    };
+
+    // Prints the rows ranked by self cycles, with their share of the total.
+    inline void print_report (std::vector<report_row> rows, std::ostream& out) {
+        std::uint64_t total = 0;
+        for (auto& row: rows)
+            total += row.self_cycles;
+        std::stable_sort(rows.begin(), rows.end(), [] (const report_row& a, const report_row& b) { return a.self_cycles > b.self_cycles; });
+
+        out << std::left
+            << std::setw(6)  << "id"
+            << std::setw(28) << "node"
+            << std::right
+            << std::setw(12) << "evals"
+            << std::setw(14) << "samples"
+            << std::setw(16) << "self cycles"
+            << std::setw(8)  << "share"
+            << std::setw(16) << "total cycles"
+            << std::setw(12) << "cyc/sample"
+            << std::setw(12) << "cache hits"
+            << std::setw(8)  << "misses"
+            << std::setw(16) << "conv cycles" << '\n';
+        for (auto& row: rows) {
+            out << std::left
+                << std::setw(6)  << ("#" + std::to_string(row.id))
+                << std::setw(28) << row.description
+                << std::right
+                << std::setw(12) << row.evaluations
+                << std::setw(14) << row.samples
+                << std::setw(16) << row.self_cycles
+                << std::setw(7)  << std::fixed << std::setprecision(1) << (total ? 100. * row.self_cycles / total : 0.) << '%'
+                << std::setw(16) << row.cycles
+                << std::setw(12) << std::setprecision(1) << (row.samples ? static_cast<double>(row.self_cycles) / row.samples : 0.)
+                << std::setw(12) << row.cache_hits
+                << std::setw(8)  << row.cache_misses
+                << std::setw(16) << row.conv_cycles << '\n';
+        }
+        out << "total self cycles: " << total << '\n';
+    }
+
+}
+
+#ifdef CYNTH_PROFILE
+#define CYNTH_PROFILE_SCOPE(profile, samples) ::cynth::profiling::scope profile_scope_{profile, samples}
+#define CYNTH_PROFILE_TIMER(counter)          ::cynth::profiling::timer profile_timer_{counter}
+#define CYNTH_PROFILE_COUNT(counter, n)       (counter).add(n)
+#else
+#define CYNTH_PROFILE_SCOPE(profile, samples)
+#define CYNTH_PROFILE_TIMER(counter)
+#define CYNTH_PROFILE_COUNT(counter, n)
+#endif
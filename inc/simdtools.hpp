@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CYNTH_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define CYNTH_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+
+Elementwise block kernels:
+
+out[i] = a[i] op b[i] for i in [0, n)
+
+And a dot product:
+
+sum of a[i] * b[i] for i in [0, n)
+
+Each kernel has a scalar fallback and vectorized versions for SSE2, AVX2 and AVX-512 on x86 and NEON on AArch64.
+The x86 versions are compiled with function-level target attributes, so the whole program does not need to be built
+with -mavx2 or -mavx512f. The best available version is chosen once at runtime.
+Output may alias either of the inputs.
+
+*/
+
+namespace cynth::simd_tools {
+
+    enum instruction_set_enum { SCALAR, SSE2, AVX2, AVX512, NEON };
+
+    instruction_set_enum detect_instruction_set () {
+        #if defined(CYNTH_SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SSE2;
+        return SCALAR;
+        #elif defined(CYNTH_SIMD_NEON)
+        return NEON;
+        #else
+        return SCALAR;
+        #endif
+    }
+
+    instruction_set_enum instruction_set () {
+        static const instruction_set_enum set = detect_instruction_set();
+        return set;
+    }
+
+    const char* instruction_set_name (instruction_set_enum set) {
+        switch (set) {
+        case SSE2:   return "SSE2";
+        case AVX2:   return "AVX2";
+        case AVX512: return "AVX-512";
+        case NEON:   return "NEON";
+        case SCALAR: default:
+            return "scalar";
+        }
+    }
+
+    template <typename T>
+    struct kernels {
+        using binary_t = void (*) (const T*, const T*, T*, std::size_t);
+        using dot_t    = T    (*) (const T*, const T*, std::size_t);
+
+        binary_t add;
+        binary_t sub;
+        binary_t mult;
+        binary_t div;
+        dot_t    dot;
+    };
+
+    // Defines a kernel for one vector type. The remainder is processed by the scalar loop.
+    #define CYNTH_SIMD_BINARY_KERNEL(NAME, ATTRIBUTES, T, WIDTH, LOAD, STORE, OP, SCALAR_OP) \
+        ATTRIBUTES void NAME (const T* a, const T* b, T* out, std::size_t n) {              \
+            std::size_t i = 0;                                                              \
+            for (; i + WIDTH <= n; i += WIDTH)                                              \
+                STORE(out + i, OP(LOAD(a + i), LOAD(b + i)));                               \
+            for (; i < n; ++i)                                                              \
+                out[i] = a[i] SCALAR_OP b[i];                                               \
+        }
+
+    // The vector accumulator is reduced through memory, which only happens once per call.
+    #define CYNTH_SIMD_DOT_KERNEL(NAME, ATTRIBUTES, T, WIDTH, LOAD, STORE, ZERO, ADD, MULT) \
+        ATTRIBUTES T NAME (const T* a, const T* b, std::size_t n) {                        \
+            auto acc = ZERO();                                                              \
+            std::size_t i = 0;                                                              \
+            for (; i + WIDTH <= n; i += WIDTH)                                              \
+                acc = ADD(acc, MULT(LOAD(a + i), LOAD(b + i)));                             \
+            alignas(64) T lanes[WIDTH];                                                     \
+            STORE(lanes, acc);                                                              \
+            T result = 0;                                                                   \
+            for (std::size_t j = 0; j < WIDTH; ++j)                                         \
+                result += lanes[j];                                                         \
+            for (; i < n; ++i)                                                              \
+                result += a[i] * b[i];                                                      \
+            return result;                                                                  \
+        }
+
+    #define CYNTH_SIMD_KERNEL_SET(PREFIX, ATTRIBUTES, T, WIDTH, LOAD, STORE, ZERO, ADD, SUB, MULT, DIV) \
+        CYNTH_SIMD_BINARY_KERNEL(PREFIX##_add,  ATTRIBUTES, T, WIDTH, LOAD, STORE, ADD,  +)             \
+        CYNTH_SIMD_BINARY_KERNEL(PREFIX##_sub,  ATTRIBUTES, T, WIDTH, LOAD, STORE, SUB,  -)             \
+        CYNTH_SIMD_BINARY_KERNEL(PREFIX##_mult, ATTRIBUTES, T, WIDTH, LOAD, STORE, MULT, *)             \
+        CYNTH_SIMD_BINARY_KERNEL(PREFIX##_div,  ATTRIBUTES, T, WIDTH, LOAD, STORE, DIV,  /)             \
+        CYNTH_SIMD_DOT_KERNEL   (PREFIX##_dot,  ATTRIBUTES, T, WIDTH, LOAD, STORE, ZERO, ADD, MULT)     \
+        template <> kernels<T> PREFIX##_kernels<T> () { return {PREFIX##_add, PREFIX##_sub, PREFIX##_mult, PREFIX##_div, PREFIX##_dot}; }
+
+    template <typename T> void scalar_add  (const T* a, const T* b, T* out, std::size_t n) { for (std::size_t i = 0; i < n; ++i) out[i] = a[i] + b[i]; }
+    template <typename T> void scalar_sub  (const T* a, const T* b, T* out, std::size_t n) { for (std::size_t i = 0; i < n; ++i) out[i] = a[i] - b[i]; }
+    template <typename T> void scalar_mult (const T* a, const T* b, T* out, std::size_t n) { for (std::size_t i = 0; i < n; ++i) out[i] = a[i] * b[i]; }
+    template <typename T> void scalar_div  (const T* a, const T* b, T* out, std::size_t n) { for (std::size_t i = 0; i < n; ++i) out[i] = a[i] / b[i]; }
+
+    template <typename T> T    scalar_dot  (const T* a, const T* b, std::size_t n) { T result = 0; for (std::size_t i = 0; i < n; ++i) result += a[i] * b[i]; return result; }
+
+    template <typename T>
+    kernels<T> scalar_kernels () { return {scalar_add<T>, scalar_sub<T>, scalar_mult<T>, scalar_div<T>, scalar_dot<T>}; }
+
+    #if defined(CYNTH_SIMD_X86)
+    #define CYNTH_SIMD_SSE2   __attribute__((target("sse2")))
+    #define CYNTH_SIMD_AVX2   __attribute__((target("avx2")))
+    #define CYNTH_SIMD_AVX512 __attribute__((target("avx512f")))
+
+    template <typename T> kernels<T> sse2_kernels   ();
+    template <typename T> kernels<T> avx2_kernels   ();
+    template <typename T> kernels<T> avx512_kernels ();
+
+    CYNTH_SIMD_KERNEL_SET(sse2,   CYNTH_SIMD_SSE2,   float,  4,  _mm_loadu_ps,    _mm_storeu_ps,    _mm_setzero_ps,    _mm_add_ps,    _mm_sub_ps,    _mm_mul_ps,    _mm_div_ps)
+    CYNTH_SIMD_KERNEL_SET(sse2,   CYNTH_SIMD_SSE2,   double, 2,  _mm_loadu_pd,    _mm_storeu_pd,    _mm_setzero_pd,    _mm_add_pd,    _mm_sub_pd,    _mm_mul_pd,    _mm_div_pd)
+    CYNTH_SIMD_KERNEL_SET(avx2,   CYNTH_SIMD_AVX2,   float,  8,  _mm256_loadu_ps, _mm256_storeu_ps, _mm256_setzero_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps)
+    CYNTH_SIMD_KERNEL_SET(avx2,   CYNTH_SIMD_AVX2,   double, 4,  _mm256_loadu_pd, _mm256_storeu_pd, _mm256_setzero_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd)
+    CYNTH_SIMD_KERNEL_SET(avx512, CYNTH_SIMD_AVX512, float,  16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_setzero_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps)
+    CYNTH_SIMD_KERNEL_SET(avx512, CYNTH_SIMD_AVX512, double, 8,  _mm512_loadu_pd, _mm512_storeu_pd, _mm512_setzero_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_div_pd)
+    #endif
+
+    #if defined(CYNTH_SIMD_NEON)
+    template <typename T> kernels<T> neon_kernels ();
+
+    float32x4_t neon_zero_f32 () { return vdupq_n_f32(0); }
+    float64x2_t neon_zero_f64 () { return vdupq_n_f64(0); }
+
+    CYNTH_SIMD_KERNEL_SET(neon, , float,  4, vld1q_f32, vst1q_f32, neon_zero_f32, vaddq_f32, vsubq_f32, vmulq_f32, vdivq_f32)
+    CYNTH_SIMD_KERNEL_SET(neon, , double, 2, vld1q_f64, vst1q_f64, neon_zero_f64, vaddq_f64, vsubq_f64, vmulq_f64, vdivq_f64)
+    #endif
+
+    template <typename T>
+    kernels<T> select_kernels (instruction_set_enum set) {
+        switch (set) {
+        #if defined(CYNTH_SIMD_X86)
+        case AVX512: return avx512_kernels<T>();
+        case AVX2:   return avx2_kernels<T>();
+        case SSE2:   return sse2_kernels<T>();
+        #endif
+        #if defined(CYNTH_SIMD_NEON)
+        case NEON:   return neon_kernels<T>();
+        #endif
+        default:     return scalar_kernels<T>();
+        }
+    }
+
+    // Chosen once, on the first use.
+    template <typename T>
+    const kernels<T>& dispatch () {
+        static const kernels<T> table = select_kernels<T>(instruction_set());
+        return table;
+    }
+
+    template <typename T> void add  (const T* a, const T* b, T* out, std::size_t n) { dispatch<T>().add (a, b, out, n); }
+    template <typename T> void sub  (const T* a, const T* b, T* out, std::size_t n) { dispatch<T>().sub (a, b, out, n); }
+    template <typename T> void mult (const T* a, const T* b, T* out, std::size_t n) { dispatch<T>().mult(a, b, out, n); }
+    template <typename T> void div  (const T* a, const T* b, T* out, std::size_t n) { dispatch<T>().div (a, b, out, n); }
+    template <typename T> T    dot  (const T* a, const T* b, std::size_t n)         { return dispatch<T>().dot(a, b, n); }
+
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "config.hpp"
+#include "functional.hpp"
+#include "wavetables.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+
+namespace cynth {
+
+    /* Expression templates for graphs, that are fully known at compile time.
+
+    The operators mirror those of composite_function (+ - * / | and composition),
+    but the structure of the graph is encoded in the type, so the whole expression
+    is inlined into a single loop:
+
+        auto out = amp * static_fs::sin(static_t{} * freq * (2*constants::pi)) + shift;
+        out.render(t0, dt, buffer, n);
+
+    Subexpressions are stored by value, so temporaries are safe to combine.
+    At the boundaries:
+    A wave_function used in an expression is referenced (static_ref) and evaluated per sample.
+    (Except for the input variable t{}, which is replaced by static_identity.)
+    A static_function converts to a wave_function referencing it, so it must outlive the graph using it.
+    */
+
+    /* -- Expression nodes: ------------------------------------------------- */
+
+    // Every node also reports the latest revision of what it reads (see function_source::revision).
+
+    template <typename T>
+    struct static_identity {
+        using value_t = T;
+        constexpr T operator() (T in) const { return in; }
+        unsigned_t revision () const { return 0; }
+    };
+
+    template <typename T>
+    struct static_constant {
+        using value_t = T;
+        T value;
+        constexpr T operator() (T) const { return this->value; }
+        unsigned_t revision () const { return 0; }
+    };
+
+    // A value that may change between evaluations, but is not a function of the input.
+    template <typename T>
+    struct static_parameter {
+        using value_t = T;
+        const T* value;
+        value_revision<T> watch = {};
+        constexpr T operator() (T) const { return *this->value; }
+        unsigned_t revision () const { return this->watch(*this->value); }
+    };
+
+    // Func must be a stateless functor.
+    template <typename T, typename Func>
+    struct static_call {
+        using value_t = T;
+        T operator() (T in) const { return Func{}(in); }
+        unsigned_t revision () const { return 0; }
+    };
+
+    template <typename T>
+    struct static_ref {
+        using value_t = T;
+        const composite_function<T>* function;
+        T operator() (T in) const { return (*this->function)(in); }
+        unsigned_t revision () const { return this->function->latest_revision(); }
+    };
+
+    template <typename Op, typename First, typename Second>
+    struct static_binary {
+        using value_t = typename First::value_t;
+        First  first;
+        Second second;
+        constexpr value_t operator() (value_t in) const { return Op{}(this->first(in), this->second(in)); }
+        unsigned_t revision () const { return std::max(this->first.revision(), this->second.revision()); }
+    };
+
+    template <typename Outer, typename Inner>
+    struct static_composition {
+        using value_t = typename Outer::value_t;
+        Outer outer;
+        Inner inner;
+        constexpr value_t operator() (value_t in) const { return this->outer(this->inner(in)); }
+        unsigned_t revision () const { return std::max(this->outer.revision(), this->inner.revision()); }
+    };
+
+    template <typename First, typename Second>
+    struct static_convolution {
+        using value_t    = typename First::value_t;
+        using function_t = composite_function<value_t>;
+        First  first;
+        Second second;
+        value_t operator() (value_t in) const {
+            value_t result = 0;
+            for (std::size_t i = 0; i < function_t::filter_order; ++i)
+                result += this->first(function_t::floating_time(i)) * this->second(in - function_t::floating_time(i));
+            return result;
+        }
+        unsigned_t revision () const { return std::max(this->first.revision(), this->second.revision()); }
+    };
+
+    /* -- Expression wrapper: ----------------------------------------------- */
+
+    template <typename Expr>
+    class static_function: public function_source<typename Expr::value_t> {
+    public:
+        using expr_t     = Expr;
+        using value_t    = typename Expr::value_t;
+        using function_t = composite_function<value_t>;
+
+        constexpr static_function (const Expr& expr = {}): expr_{expr} {}
+
+        const Expr& expr () const { return this->expr_; }
+
+        value_t operator() (value_t in) const override { return this->expr_(in); }
+
+        void render (const value_t* in, value_t* out, std::size_t n) const override {
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = this->expr_(in[i]);
+        }
+
+        unsigned_t revision () const override { return this->expr_.revision(); }
+
+        // out[i] = (*this)(t0 + i * dt) for i in [0, n)
+        void render (value_t t0, value_t dt, value_t* out, std::size_t n) const {
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = this->expr_(t0 + static_cast<value_t>(i) * dt);
+        }
+
+        // Composition:
+        template <typename Inner>
+        constexpr static_function<static_composition<Expr, Inner>> operator() (const static_function<Inner>& inner) const {
+            return {{this->expr_, inner.expr()}};
+        }
+        static_function<static_composition<Expr, static_ref<value_t>>> operator() (const function_t& inner) const {
+            return {{this->expr_, {&inner}}};
+        }
+        // Composing with the input variable changes nothing:
+        constexpr static_function operator() (const var<value_t>&) const { return *this; }
+
+        // The resulting wave_function references this object.
+        operator function_t () const { return {static_cast<const function_source<value_t>&>(*this)}; }
+
+    private:
+        Expr expr_;
+    };
+
+    /* -- Operand conversions: ---------------------------------------------- */
+
+    namespace static_operands {
+        template <typename Operand> struct is_static                          : std::false_type {};
+        template <typename Expr>    struct is_static<static_function<Expr>>   : std::true_type  {};
+
+        // At least one of the operands must be a static_function, the other one may be
+        // a static_function, a wave_function or a constant.
+        template <typename First, typename Second>
+        constexpr bool enabled = is_static<First>::value || is_static<Second>::value;
+
+        // Value type of the static operand, constants are converted to it.
+        template <typename First, typename Second>
+        using value_t = typename std::conditional_t<is_static<First>::value, First, Second>::value_t;
+
+        template <typename T, typename Operand, typename = void>
+        struct expr_of                                                        { using type = static_ref<T>; };
+        template <typename T, typename Operand>
+        struct expr_of<T, Operand, std::enable_if_t<std::is_arithmetic_v<Operand>>> { using type = static_constant<T>; };
+        template <typename T, typename Expr>
+        struct expr_of<T, static_function<Expr>>                              { using type = Expr; };
+        template <typename T>
+        struct expr_of<T, var<T>>                                             { using type = static_identity<T>; };
+        template <typename T, typename Operand> using expr_of_t = typename expr_of<T, Operand>::type;
+
+        template <typename T, typename Expr>
+        constexpr const Expr& wrap (const static_function<Expr>& func) { return func.expr(); }
+        template <typename T>
+        constexpr static_ref<T> wrap (const composite_function<T>& func) { return {&func}; }
+        template <typename T>
+        constexpr static_identity<T> wrap (const var<T>&) { return {}; }
+        template <typename T, typename Operand, typename = std::enable_if_t<std::is_arithmetic_v<Operand>>>
+        constexpr static_constant<T> wrap (const Operand& constant) { return {static_cast<T>(constant)}; }
+
+        template <typename Op, typename First, typename Second, typename T = value_t<First, Second>>
+        using binary_t = static_function<static_binary<Op, expr_of_t<T, First>, expr_of_t<T, Second>>>;
+        template <typename First, typename Second, typename T = value_t<First, Second>>
+        using convolution_t = static_function<static_convolution<expr_of_t<T, First>, expr_of_t<T, Second>>>;
+    }
+
+    template <typename First, typename Second, typename = std::enable_if_t<static_operands::enabled<First, Second>>>
+    constexpr static_operands::binary_t<std::plus<>, First, Second> operator + (const First& first, const Second& second) {
+        using T = static_operands::value_t<First, Second>;
+        return {{static_operands::wrap<T>(first), static_operands::wrap<T>(second)}};
+    }
+    template <typename First, typename Second, typename = std::enable_if_t<static_operands::enabled<First, Second>>>
+    constexpr static_operands::binary_t<std::minus<>, First, Second> operator - (const First& first, const Second& second) {
+        using T = static_operands::value_t<First, Second>;
+        return {{static_operands::wrap<T>(first), static_operands::wrap<T>(second)}};
+    }
+    template <typename First, typename Second, typename = std::enable_if_t<static_operands::enabled<First, Second>>>
+    constexpr static_operands::binary_t<std::multiplies<>, First, Second> operator * (const First& first, const Second& second) {
+        using T = static_operands::value_t<First, Second>;
+        return {{static_operands::wrap<T>(first), static_operands::wrap<T>(second)}};
+    }
+    template <typename First, typename Second, typename = std::enable_if_t<static_operands::enabled<First, Second>>>
+    constexpr static_operands::binary_t<std::divides<>, First, Second> operator / (const First& first, const Second& second) {
+        using T = static_operands::value_t<First, Second>;
+        return {{static_operands::wrap<T>(first), static_operands::wrap<T>(second)}};
+    }
+    template <typename First, typename Second, typename = std::enable_if_t<static_operands::enabled<First, Second>>>
+    constexpr static_operands::convolution_t<First, Second> operator | (const First& first, const Second& second) {
+        using T = static_operands::value_t<First, Second>;
+        return {{static_operands::wrap<T>(first), static_operands::wrap<T>(second)}};
+    }
+
+    /* -- Shorthands: ------------------------------------------------------- */
+
+    template <typename T>
+    constexpr static_function<static_parameter<T>> static_param (const T& value) { return {{&value}}; }
+
+    using static_t = static_function<static_identity<floating_t>>;
+
+    struct static_fs {
+        struct sin_f  { floating_t operator() (floating_t t) const { return math::sin(t);  } };
+        struct cos_f  { floating_t operator() (floating_t t) const { return math::cos(t);  } };
+        struct sinc_f { floating_t operator() (floating_t t) const { return math::sinc(t); } };
+        struct saw_f  { floating_t operator() (floating_t t) const { return math::saw(t);  } };
+
+        using sin_t  = static_function<static_call<floating_t, sin_f>>;
+        using cos_t  = static_function<static_call<floating_t, cos_f>>;
+        using sinc_t = static_function<static_call<floating_t, sinc_f>>;
+        using saw_t  = static_function<static_call<floating_t, saw_f>>;
+
+        inline constexpr static sin_t  sin  = {};
+        inline constexpr static cos_t  cos  = {};
+        inline constexpr static sinc_t sinc = {};
+        inline constexpr static saw_t  saw  = {};
+    };
+
+}
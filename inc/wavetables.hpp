@@ -58,5 +58,11 @@ namespace cynth {
                 ? 1
                 : sin(constants::pi * x) / (constants::pi * x);
         }
+        floating_t saw (floating_t x) {
+            x = x < 0
+                ? 2*constants::pi - std::fmod(std::abs(x), 2*constants::pi)
+                : std::fmod(x, 2*constants::pi);
+            return (1/constants::pi) * x - 1;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "config.hpp"
+#include "functional.hpp"
+#include "compiled_function.hpp"
+#include "convolution.hpp"
+#include "devices/oscillator.hpp"
+#include "devices/filter.hpp"
+#include "api/null/driver.hpp"
+
+#ifdef CYNTH_API_ASIO
+#include "api/asio/buffertools.hpp"
+#endif
+
+#include <exception>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <memory>
+#include <limits>
+#include <cmath>
+
+/*
+
+Microbenchmarks of the synthesis hot paths.
+Every case is timed over several repetitions of at least min_time, the best one is reported
+as nanoseconds per sample and as a real-time factor (seconds of audio rendered per second)
+at the default sample rate.
+
+*/
+
+using namespace cynth;
+
+namespace {
+
+    constexpr std::size_t block = 4096;
+    const auto            min_time = std::chrono::milliseconds{20};
+
+    // Keeps the results from being optimized away.
+    volatile floating_t sink;
+
+    // func() processes `samples` samples. Returns the best time per sample in nanoseconds.
+    template <typename Func>
+    double measure (std::size_t samples, Func func) {
+        using clock = std::chrono::steady_clock;
+        func();
+        double best = std::numeric_limits<double>::infinity();
+        for (int repetition = 0; repetition < 5; ++repetition) {
+            std::size_t iterations = 0;
+            auto        start      = clock::now();
+            auto        elapsed    = clock::duration{0};
+            do {
+                func();
+                ++iterations;
+                elapsed = clock::now() - start;
+            } while (elapsed < min_time);
+            best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / (iterations * samples));
+        }
+        return best;
+    }
+
+    void section (const std::string& name) {
+        std::cout << '\n' << name << ":\n";
+    }
+
+    void report (const std::string& name, double ns) {
+        double real_time = 1e9 / wave_function::sample_rate / ns;
+        std::cout << "  " << std::left << std::setw(44) << name << std::right << std::fixed
+                  << std::setw(12) << std::setprecision(2) << ns << " ns/sample"
+                  << std::setw(14) << std::setprecision(1) << real_time << "x real time\n";
+    }
+
+    // Single-sample, block and compiled evaluation of a graph, each over the same stream of consecutive blocks.
+    void evaluate (const std::string& name, const wave_function& patch) {
+        auto dt = wave_function::sample_length;
+        std::vector<floating_t> out(block);
+        floating_t t0 = 0;
+
+        report(name + " (single sample)", measure(block, [&] {
+            floating_t sum = 0;
+            for (std::size_t i = 0; i < block; ++i)
+                sum += patch(t0 + i * dt);
+            t0 += block * dt;
+            sink = sum;
+        }));
+        t0 = 0;
+        report(name + " (block)", measure(block, [&] {
+            patch.render(t0, dt, out.data(), block);
+            t0 += block * dt;
+            sink = out[block - 1];
+        }));
+        t0 = 0;
+        compiled_function<floating_t> compiled{patch};
+        report(name + " (compiled)", measure(block, [&] {
+            compiled.render(t0, dt, out.data(), block);
+            t0 += block * dt;
+            sink = out[block - 1];
+        }));
+    }
+
+    std::vector<floating_t> times () {
+        std::vector<floating_t> result(block);
+        for (std::size_t i = 0; i < block; ++i)
+            result[i] = static_cast<floating_t>(i) * 0.01f;
+        return result;
+    }
+
+    void bench_math () {
+        section("Math");
+        auto in = times();
+        auto loop = [&] (auto func) {
+            return measure(block, [&] {
+                floating_t sum = 0;
+                for (auto t: in)
+                    sum += func(t);
+                sink = sum;
+            });
+        };
+        report("std::sin",     loop([] (floating_t t) { return std::sin(t); }));
+        report("math::sin",    loop([] (floating_t t) { return math::sin(t); }));
+        report("wave_fs::sin", loop([] (floating_t t) { return wave_fs::sin(t); }));
+        report("wave_fs::saw", loop([] (floating_t t) { return wave_fs::saw(t); }));
+    }
+
+    void bench_patches () {
+        section("Reference patches");
+        wave_arena arena;
+
+        oscillator sine{&arena};
+        sine.freq = 440;
+        evaluate("sine oscillator", sine.out);
+
+        oscillator saw{&arena};
+        saw.freq = 110;
+        saw.wave = wave_fs::saw;
+        evaluate("saw oscillator", saw.out);
+
+        oscillator lfo{&arena};
+        lfo.freq = 3;
+        lfo.amp  = 0.2;
+        lfo.shift = 0.3;
+        oscillator modulated{&arena};
+        modulated.freq = 440;
+        modulated.amp  = lfo;
+        evaluate("sine with LFO amplitude", modulated.out);
+
+        std::vector<std::unique_ptr<oscillator>> voices;
+        const wave_function* mix = nullptr;
+        for (int i = 0; i < 8; ++i) {
+            voices.emplace_back(new oscillator{&arena});
+            voices.back()->freq = 110.f * (i + 1);
+            voices.back()->amp  = 0.1;
+            mix = mix ? &arena(*mix + voices.back()->out) : &voices.back()->out;
+        }
+        evaluate("8 mixed oscillators", *mix);
+
+        filter lowpass{&arena};
+        lowpass.cutoff = 2000;
+        auto& filtered = arena(lowpass.impulse_response | saw.out);
+        evaluate("filtered saw (conv)", filtered);
+
+        wave_function::cache_t cache;
+        oscillator cached{&arena};
+        cached.freq = 500;
+        cached.set_cache(1.f / 500, cache);
+        evaluate("cached oscillator", cached.out);
+    }
+
+    void bench_convolution () {
+        section("Convolution");
+        auto dt = wave_function::sample_length;
+
+        oscillator source;
+        source.freq = 220;
+        filter lowpass;
+        lowpass.cutoff = 2000;
+        auto filtered = lowpass.impulse_response | source.out;
+        report("conv(), filter_order " + std::to_string(wave_function::filter_order), measure(block, [&] {
+            floating_t sum = 0;
+            for (std::size_t i = 0; i < block; ++i)
+                sum += filtered.conv(i * dt);
+            sink = sum;
+        }));
+
+        // filter_order is fixed at compile time, the streaming filters used by compiled_function
+        // are measured at other kernel lengths:
+        auto in = times();
+        std::vector<floating_t> out(block);
+        for (std::size_t order: {32, 128, 512, 2048}) {
+            std::vector<floating_t> kernel(order);
+            for (std::size_t i = 0; i < order; ++i)
+                kernel[i] = lowpass.impulse_response(wave_function::floating_time(i));
+            fir_filter<floating_t> direct{kernel};
+            report("fir_filter, order " + std::to_string(order), measure(block, [&] {
+                direct.process(in.data(), out.data(), block);
+                sink = out[block - 1];
+            }));
+            partitioned_convolver<floating_t> partitioned{kernel, order >= compiled_function<floating_t>::fft_threshold ? compiled_function<floating_t>::fft_partition : order};
+            report("partitioned_convolver, order " + std::to_string(order), measure(block, [&] {
+                partitioned.process(in.data(), out.data(), block);
+                sink = out[block - 1];
+            }));
+        }
+    }
+
+    void bench_cache () {
+        section("Cache lookup");
+        auto in = times();
+        std::vector<floating_t> out(block);
+        const char* names[] = {"nearest", "linear", "cubic"};
+        for (auto interpolation: {NEAREST, LINEAR, CUBIC}) {
+            wave_function::cache_t cache;
+            wave_function sine = wave_fs::sin;
+            sine.set_cache(2 * constants::pi, cache, interpolation);
+            report(std::string{"single lookup, "} + names[interpolation], measure(block, [&] {
+                floating_t sum = 0;
+                for (auto t: in)
+                    sum += cache(t);
+                sink = sum;
+            }));
+            report(std::string{"block lookup, "} + names[interpolation], measure(block, [&] {
+                cache.render(in.data(), out.data(), block);
+                sink = out[block - 1];
+            }));
+        }
+    }
+
+    // The whole callback path of the headless backend, on its simulated clock:
+    void bench_null_driver () {
+        section("Null driver (simulated clock)");
+        auto sample_rate = wave_function::sample_rate;
+        oscillator saw;
+        saw.freq = 110;
+        saw.wave = wave_fs::saw;
+        filter lowpass;
+        lowpass.cutoff = 2000;
+        auto filtered = lowpass.impulse_response | saw.out;
+        for (unsigned_t buffer_size: {64, 256, 1024}) {
+            api::null::driver::buffer_size = buffer_size;
+            api::null::driver::sample_rate = sample_rate;
+            api::null::driver::init();
+            api::null::driver::set_input(filtered);
+            report("filtered saw, buffer " + std::to_string(buffer_size), measure(block, [&] {
+                api::null::driver::loop(api::null::driver::SIMULATED, block / buffer_size);
+            }));
+        }
+    }
+
+    #ifdef CYNTH_API_ASIO
+    void bench_asio () {
+        section("ASIO sample conversion");
+        struct named_type { ASIOSampleType type; const char* name; };
+        const named_type types[] = {
+            {ASIOSTInt16LSB,   "Int16LSB"},   {ASIOSTInt24LSB,   "Int24LSB"},   {ASIOSTInt32LSB,   "Int32LSB"},
+            {ASIOSTFloat32LSB, "Float32LSB"}, {ASIOSTFloat64LSB, "Float64LSB"},
+            {ASIOSTInt32LSB16, "Int32LSB16"}, {ASIOSTInt32LSB18, "Int32LSB18"}, {ASIOSTInt32LSB20, "Int32LSB20"}, {ASIOSTInt32LSB24, "Int32LSB24"},
+            {ASIOSTInt16MSB,   "Int16MSB"},   {ASIOSTInt24MSB,   "Int24MSB"},   {ASIOSTInt32MSB,   "Int32MSB"},
+            {ASIOSTFloat32MSB, "Float32MSB"}, {ASIOSTFloat64MSB, "Float64MSB"},
+            {ASIOSTInt32MSB16, "Int32MSB16"}, {ASIOSTInt32MSB18, "Int32MSB18"}, {ASIOSTInt32MSB20, "Int32MSB20"}, {ASIOSTInt32MSB24, "Int32MSB24"}};
+
+        std::vector<floating_t>   in(block);
+        std::vector<std::uint8_t> memory(8 * block);
+        for (std::size_t i = 0; i < block; ++i)
+            in[i] = 0.5f * math::sin(i * 0.01f);
+        for (auto [type, name]: types) {
+            api::asio::buffer buffer{memory.data(), type, block};
+            report(name, measure(block, [&] {
+                for (std::size_t i = 0; i < block; ++i)
+                    buffer[i] = in[i];
+                sink = memory[0];
+            }));
+        }
+    }
+    #endif
+
+}
+
+int main () {
+    try {
+        std::cout << "SIMD: " << simd_tools::instruction_set_name(simd_tools::instruction_set())
+                  << ", sample rate: " << wave_function::sample_rate << " Hz\n";
+        bench_math();
+        bench_patches();
+        bench_convolution();
+        bench_cache();
+        bench_null_driver();
+        #ifdef CYNTH_API_ASIO
+        bench_asio();
+        #endif
+    } catch (std::exception& e) {
+        std::cout << e.what() << '\n';
+        return 1;
+    }
+}
@@ -28,7 +28,7 @@ int main () {
         //auto out = f.impulse_response;
         //out.set_cache(1./500, cache2);
 
-        api::driver::input = out;
+        api::driver::set_input(out);
 
         std::this_thread::sleep_for(std::chrono::seconds{30});
 
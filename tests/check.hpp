@@ -0,0 +1,15 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the test executables: A failed check is reported and counted,
+// main() returns the count, so that ctest sees the failure.
+inline int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cout << __FILE__ << ':' << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            ++failures; \
+        } \
+    } while (false)
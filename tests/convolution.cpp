@@ -0,0 +1,58 @@
+#include "check.hpp"
+
+#include "convolution.hpp"
+#include "compiled_function.hpp"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+using namespace cynth;
+
+namespace {
+
+    // Largest difference from the direct convolution (in double), relative to the peak of the output.
+    // The input is processed in blocks of irregular sizes, so the partitions are crossed anywhere.
+    // Halfway through, the history is refilled by reset() and the stream continues from there.
+    double convolver_error (std::size_t taps, std::size_t partition) {
+        std::mt19937                          random{static_cast<unsigned>(taps)};
+        std::uniform_real_distribution<float> uniform{-1, 1};
+        std::vector<float> kernel(taps), in(3 * taps + 500), out(in.size());
+        for (auto& k: kernel) k = uniform(random);
+        for (auto& x: in)     x = uniform(random);
+
+        partitioned_convolver<float> convolver{kernel, partition};
+        std::size_t sizes[] = {37, 256, 1, 100, 64, 7};
+        std::size_t half    = in.size() / 2;
+        for (std::size_t offset = 0, s = 0; offset < in.size(); ++s) {
+            auto n = std::min(sizes[s % std::size(sizes)], (offset < half ? half : in.size()) - offset);
+            convolver.process(in.data() + offset, out.data() + offset, n);
+            offset += n;
+            if (offset == half)
+                convolver.reset([&] (std::size_t j) { return j <= half ? in[half - j] : 0.f; });
+        }
+
+        double error = 0, peak = 0;
+        for (std::size_t k = 0; k < in.size(); ++k) {
+            double expected = 0;
+            for (std::size_t i = 0; i < taps && i <= k; ++i)
+                expected += static_cast<double>(kernel[i]) * in[k - i];
+            error = std::max(error, std::abs(out[k] - expected));
+            peak  = std::max(peak,  std::abs(expected));
+        }
+        return error / peak;
+    }
+
+}
+
+int main () {
+    // The sizes compiled_function uses from fft_threshold on, and some longer kernels:
+    constexpr auto partition = compiled_function<float>::fft_partition;
+    for (std::size_t taps: {compiled_function<float>::fft_threshold, std::size_t{1000}, std::size_t{4096}})
+        CHECK(convolver_error(taps, partition) < 1e-5);
+
+    // A single partition is a plain FIR filter:
+    CHECK(convolver_error(32, 32) < 1e-5);
+
+    return failures;
+}
@@ -0,0 +1,59 @@
+#include "check.hpp"
+
+#include "functional.hpp"
+#include "compiled_function.hpp"
+#include "devices/oscillator.hpp"
+
+#include <vector>
+#include <cmath>
+
+using namespace cynth;
+
+namespace {
+
+    // Largest difference between the compiled FIR filter and the direct convolution over a few blocks,
+    // relative to the peak of the output (both sum 32 products of a loud signal in single precision).
+    floating_t fir_error (compiled_function<floating_t>& compiled, const wave_function& conv, floating_t dt) {
+        constexpr std::size_t n = 4 * wave_function::block_size;
+        std::vector<floating_t> out(n);
+        floating_t t0 = 0.1f;
+        compiled.render(t0, dt, out.data(), n);
+        floating_t error = 0;
+        floating_t peak  = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            auto expected = conv(t0 + static_cast<floating_t>(i) * dt);
+            error = std::max(error, std::abs(out[i] - expected));
+            peak  = std::max(peak,  std::abs(expected));
+        }
+        return error / peak;
+    }
+
+}
+
+int main () {
+    floating_t rate = wave_function::sample_rate;
+
+    wave_function phase  = t{} * 7000.f;
+    wave_function kernel = wave_fs::sin(phase);
+    oscillator    signal;
+    signal.freq = 300;
+    signal.amp  = 7.7f;
+    wave_function conv = kernel | signal.out;
+
+    compiled_function<floating_t> compiled{conv};
+
+    // At the kernel's tap spacing and off it:
+    for (floating_t scale: {1.f, 0.5f, 2.f})
+        CHECK(fir_error(compiled, conv, scale * wave_function::sample_length) < 1e-3f);
+
+    // After a change of the sample rate, before and after sampling the kernel again:
+    wave_function::sample_rate   = 48000;
+    wave_function::sample_length = 1 / wave_function::sample_rate;
+    CHECK(fir_error(compiled, conv, wave_function::sample_length) < 1e-3f);
+    compiled.resample();
+    CHECK(fir_error(compiled, conv, wave_function::sample_length) < 1e-3f);
+
+    wave_function::sample_rate   = rate;
+    wave_function::sample_length = 1 / rate;
+    return failures;
+}
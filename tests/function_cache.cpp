@@ -0,0 +1,135 @@
+#include "check.hpp"
+
+#include "functional.hpp"
+#include "devices/oscillator.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+using namespace cynth;
+
+int main () {
+    // Periods that are and are not a power of two samples long:
+    for (floating_t period: {1.f / 500, 256 / wave_function::sample_rate, 2 * constants::pi}) {
+        for (auto interpolation: {NEAREST, LINEAR, CUBIC}) {
+            wave_function::cache_t cache;
+            cache.fill(period, wave_function::sample_rate, interpolation, 0, [&] (const floating_t* in, floating_t* out, std::size_t n) {
+                for (std::size_t i = 0; i < n; ++i)
+                    out[i] = std::sin(in[i] * (2 * constants::pi / period));
+            });
+            auto size = cache.size();
+            CHECK((size & (size - 1)) == 0);
+            CHECK(size >= static_cast<std::size_t>(std::lround(period * wave_function::sample_rate)));
+
+            // NEAREST is off by at most half a sample step (the slope is 2 pi / period at most):
+            floating_t tolerance = interpolation == NEAREST ? constants::pi / size + 1e-4f : 1e-3f;
+            if (interpolation == NEAREST) {
+                floating_t step = period / size;
+                CHECK(std::abs(cache(10.4f * step) - std::sin(10 * (2 * constants::pi / size))) < 1e-4f);
+                CHECK(std::abs(cache(10.6f * step) - std::sin(11 * (2 * constants::pi / size))) < 1e-4f);
+            }
+
+            // Negative times and times many periods away wrap around the period:
+            for (floating_t t: {0.f, 0.3f * period, -0.3f * period, 7.7f * period, -5.2f * period}) {
+                auto expected = std::sin(t * (2 * constants::pi / period));
+                CHECK(std::abs(cache(t) - expected) < tolerance);
+                floating_t out;
+                cache.render(&t, &out, 1);
+                CHECK(out == cache(t));
+            }
+        }
+    }
+
+    // Refills while other threads read: Every read sees a whole table of one of the fills
+    // (all the samples of fill k have the value k) and no table is freed under a reader.
+    {
+        wave_function::cache_t cache;
+        auto fill = [&] (floating_t value) {
+            cache.fill(1.f / 100, wave_function::sample_rate, LINEAR, 0, [=] (const floating_t*, floating_t* out, std::size_t n) {
+                std::fill(out, out + n, value);
+            });
+        };
+        fill(0);
+
+        std::atomic<bool> done {false};
+        std::atomic<int>  torn {0};
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 3; ++r)
+            readers.emplace_back([&] {
+                std::vector<floating_t> in(wave_function::block_size), out(wave_function::block_size);
+                for (std::size_t i = 0; i < in.size(); ++i)
+                    in[i] = i * wave_function::sample_length;
+                while (!done.load(std::memory_order_relaxed)) {
+                    cache.render(in.data(), out.data(), out.size());
+                    if (std::any_of(out.begin(), out.end(), [&] (floating_t x) { return x != out[0]; }))
+                        ++torn;
+                    floating_t single = cache(0.001f);
+                    if (single != std::floor(single))
+                        ++torn;
+                }
+            });
+        for (int k = 1; k <= 500; ++k)
+            fill(static_cast<floating_t>(k));
+        done = true;
+        for (auto& reader: readers)
+            reader.join();
+        CHECK(torn == 0);
+        CHECK(cache(0) == 500);
+    }
+
+    // Changes behind sources and parameters mark the caches above them out of date:
+    {
+        oscillator             accumulated{nullptr, PHASE_ACCUMULATOR};
+        wave_function          scaled = accumulated.out * 1.f;
+        wave_function::cache_t cache;
+        scaled.set_cache(1.f / 220, cache);
+        CHECK(!scaled.cache_dirty());
+        accumulated.freq = 440;
+        CHECK(scaled.cache_dirty());
+
+        static_oscillator<>    fixed;
+        wave_function          fixed_scaled = fixed.out * 1.f;
+        wave_function::cache_t fixed_cache;
+        fixed_scaled.set_cache(1.f / 220, fixed_cache);
+        CHECK(!fixed_scaled.cache_dirty());
+        fixed.freq = 440;
+        CHECK(fixed_scaled.cache_dirty());
+
+        floating_t             value = 1;
+        wave_function          parameter = wave_function::parameter(value);
+        wave_function          doubled   = parameter * 2.f;
+        wave_function::cache_t parameter_cache;
+        doubled.set_cache(1.f / 100, parameter_cache);
+        CHECK(!doubled.cache_dirty());
+        value = 2;
+        CHECK(doubled.cache_dirty());
+        CHECK(doubled.refresh_caches() == 1);
+        CHECK(doubled(0) == 4);
+    }
+
+    // Shared subgraphs are walked once: x[k + 1] = x[k] + x[k] has 2^64 paths, but 65 nodes.
+    // (Only walked, rendering it would still take every path.)
+    {
+        floating_t             value = 1;
+        wave_function          parameter = wave_function::parameter(value);
+        wave_function          base      = parameter * 2.f;
+        wave_function::cache_t cache;
+        base.set_cache(1.f / 100, cache);
+
+        std::vector<wave_function> chain;
+        chain.reserve(65);
+        chain.push_back(base);
+        for (int k = 0; k < 64; ++k)
+            chain.push_back(chain.back() + chain.back());
+        CHECK(chain.back().latest_revision() >= base.latest_revision());
+        CHECK(chain.back().refresh_caches() == 0);
+        value = 3;
+        CHECK(chain.back().refresh_caches() == 1);
+        CHECK(base(0) == 6);
+    }
+
+    return failures;
+}
@@ -0,0 +1,53 @@
+#include "check.hpp"
+
+#include "functional.hpp"
+#include "compiled_function.hpp"
+
+#include <vector>
+#include <cmath>
+
+using namespace cynth;
+
+int main () {
+    constexpr std::size_t lanes = 4;
+    constexpr std::size_t n     = wave_function::block_size;
+
+    // One amplitude per lane, the wave is skipped in the lanes where it's zero:
+    floating_t    amps[lanes] = {1, 0.5f, 0.25f, 0.125f};
+    wave_function amp         = wave_function::parameter(amps[0]);
+    wave_function x           = wave_fs::sin;
+    wave_function scaled      = x * 3.f;
+    wave_function shifted     = scaled + 1.f;
+    wave_function wave        = wave_fs::sin(shifted);
+    wave_function voice       = amp * wave;
+
+    compiled_function<floating_t> compiled{voice, lanes, 1};
+    auto instructions = compiled.instruction_count(); // amp, the wave and the multiplication
+
+    floating_t              t0[lanes] = {0, 0.25f, 0.5f, 0.75f};
+    std::vector<floating_t> playing (lanes * n);
+    std::vector<floating_t> muted   (lanes * n);
+
+    compiled.render_lanes(t0, wave_function::sample_length, playing.data(), n);
+    CHECK(compiled.executed_count() == lanes * instructions);
+
+    // A silent lane among playing ones only runs the amplitude and the multiplication:
+    amps[1] = 0;
+    compiled.render_lanes(t0, wave_function::sample_length, muted.data(), n);
+    CHECK(compiled.executed_count() == lanes * instructions + (lanes - 1) * instructions + 2);
+
+    for (std::size_t lane = 0; lane < lanes; ++lane)
+        for (std::size_t i = 0; i < n; ++i) {
+            auto expected = lane == 1 ? 0 : playing[lane * n + i];
+            CHECK(muted[lane * n + i] == expected);
+            if (muted[lane * n + i] != expected)
+                return failures;
+        }
+
+    // Its wave still matches once it plays again:
+    amps[1] = 0.5f;
+    compiled.render_lanes(t0, wave_function::sample_length, muted.data(), n);
+    CHECK(muted == playing);
+
+    return failures;
+}
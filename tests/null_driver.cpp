@@ -0,0 +1,33 @@
+#include "check.hpp"
+
+#include "cynth.hpp"
+
+#include <vector>
+
+using namespace cynth;
+
+int main () {
+    using null_driver = api::null::driver;
+
+    std::vector<floating_t> block;
+    null_driver::buffer_size = 64;
+    null_driver::output      = [&] (const floating_t* samples, std::size_t size) { block.assign(samples, samples + size); };
+
+    floating_t    value = 0;
+    wave_function input = wave_function::parameter(value);
+    api::driver::set_input(input);
+
+    // The position is the first sample of the next block:
+    null_driver::run(null_driver::SIMULATED, 2);
+    CHECK(api::driver::position() == 2 * null_driver::buffer_size);
+
+    // So an event sent for the sample after it is applied there, not at the start of the block:
+    CHECK(api::driver::send(value, 1, api::driver::position() + 1));
+    null_driver::loop(null_driver::SIMULATED, 1);
+    CHECK(block.size() == null_driver::buffer_size);
+    CHECK(block[0] == 0);
+    CHECK(block[1] == 1);
+    CHECK(api::driver::position() == 3 * null_driver::buffer_size);
+
+    return failures;
+}
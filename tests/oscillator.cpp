@@ -0,0 +1,43 @@
+#include "check.hpp"
+
+#include "devices/oscillator.hpp"
+
+#include <vector>
+#include <cmath>
+
+using namespace cynth;
+
+int main () {
+    constexpr std::size_t n = wave_function::block_size;
+
+    // The phase accumulator follows the spacing of its input times, not sample_length
+    // (here half of it, like a device running at twice the rate):
+    oscillator accumulated{nullptr, PHASE_ACCUMULATOR};
+    oscillator absolute;
+    accumulated.freq = 440;
+    absolute.freq    = 440;
+    floating_t dt = wave_function::sample_length / 2;
+
+    std::vector<floating_t> times(n), a(n), b(n);
+    floating_t error = 0;
+    for (std::size_t block = 0; block < 8; ++block) {
+        for (std::size_t i = 0; i < n; ++i)
+            times[i] = static_cast<floating_t>(block * n + i) * dt;
+        accumulated.out.render(times.data(), a.data(), n);
+        absolute.out.render(times.data(), b.data(), n);
+        for (std::size_t i = 0; i < n; ++i)
+            error = std::max(error, std::abs(a[i] - b[i]));
+    }
+    CHECK(error < 1e-2f);
+
+    // Switching the mode keeps the cache:
+    wave_function::cache_t cache;
+    absolute.set_cache(1.f / 440, cache);
+    absolute.set_mode(PHASE_ACCUMULATOR);
+    absolute.set_mode(ABSOLUTE_TIME);
+    CHECK(absolute.out.cache() == &cache);
+    CHECK(!absolute.out.cache_dirty());
+    CHECK(std::abs(absolute.out(0.25f / 440) - 0.5f) < 1e-3f);
+
+    return failures;
+}
@@ -0,0 +1,60 @@
+#include "check.hpp"
+
+#include "functional.hpp"
+#include "compiled_function.hpp"
+
+#include <vector>
+#include <cmath>
+
+using namespace cynth;
+
+namespace {
+
+    bool renders_like (compiled_function<floating_t>& compiled, const wave_function& func) {
+        constexpr std::size_t n = 64;
+        std::vector<floating_t> out(n);
+        compiled.render(0, wave_function::sample_length, out.data(), n);
+        for (std::size_t i = 0; i < n; ++i)
+            if (std::abs(out[i] - func(i * wave_function::sample_length)) > 1e-5f)
+                return false;
+        return true;
+    }
+
+}
+
+int main () {
+    wave_function x = wave_fs::sin;
+
+    // (x + c1) + c2 and its mirror (c1 + x) + c2 both fold into one addition,
+    // (x * c1) * c2 and (c1 * x) * c2 into one multiplication:
+    wave_function sum_inner      = x + 2.f;
+    wave_function sum_mirror     = 2.f + x;
+    wave_function product_inner  = x * 2.f;
+    wave_function product_mirror = 2.f * x;
+    wave_function outers[] = {sum_inner + 3.f, sum_mirror + 3.f, product_inner * 3.f, product_mirror * 3.f};
+
+    for (auto& outer: outers) {
+        compiled_function<floating_t> compiled{outer};
+        CHECK(compiled.instruction_count() == 2); // sin and one addition or multiplication
+        CHECK(renders_like(compiled, outer));
+    }
+
+    // Folded constants keep NaN and the sign of zero:
+    wave_function zero          = 0.f;
+    wave_function negative_zero = -0.f;
+    wave_function three         = 3.f;
+    wave_function infinity      = 1.f / negative_zero;
+    wave_function signed_sum    = zero + infinity;
+    wave_function not_a_number  = zero / zero;
+    wave_function nan_sum       = three + not_a_number;
+
+    floating_t out;
+    compiled_function<floating_t> signed_compiled{signed_sum};
+    signed_compiled.render(0, wave_function::sample_length, &out, 1);
+    CHECK(std::isinf(out) && out < 0);
+    compiled_function<floating_t> nan_compiled{nan_sum};
+    nan_compiled.render(0, wave_function::sample_length, &out, 1);
+    CHECK(std::isnan(out));
+
+    return failures;
+}
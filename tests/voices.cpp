@@ -0,0 +1,62 @@
+#include "check.hpp"
+
+#include "devices/oscillator.hpp"
+#include "devices/voices.hpp"
+
+#include <vector>
+#include <cmath>
+
+using namespace cynth;
+
+namespace {
+
+    constexpr std::size_t n = wave_function::block_size;
+
+    // Instructions executed while rendering the next block.
+    unsigned_t block_work (voice_allocator& voices, floating_t& time, std::vector<floating_t>& out) {
+        std::vector<floating_t> times(n);
+        for (std::size_t i = 0; i < n; ++i)
+            times[i] = time + static_cast<floating_t>(i) * wave_function::sample_length;
+        time += static_cast<floating_t>(n) * wave_function::sample_length;
+        auto before = voices.executed_count();
+        voices.render(times.data(), out.data(), n);
+        return voices.executed_count() - before;
+    }
+
+}
+
+int main () {
+    voice_allocator voices{8};
+    oscillator      osc;
+    osc.freq = voices.freq;
+    osc.amp  = voices.velocity;
+    voices.set_voice(osc.out);
+
+    floating_t              time = 0;
+    std::vector<floating_t> out(n);
+
+    // The work tracks the number of active voices, not the size of the allocator:
+    CHECK(block_work(voices, time, out) == 0);
+    voices.note_on(440);
+    auto one = block_work(voices, time, out);
+    CHECK(one > 0);
+    voices.note_on(550);
+    voices.note_on(660);
+    CHECK(voices.active_count() == 3);
+    CHECK(block_work(voices, time, out) == 3 * one);
+
+    // A single voice still plays its note:
+    voice_allocator single{8};
+    single.set_voice(osc.out);
+    oscillator reference;
+    reference.freq = 440;
+    reference.amp  = 1;
+    floating_t start = 0;
+    block_work(single, start, out);
+    single.note_on(440);
+    block_work(single, start, out);
+    for (std::size_t i = 0; i < n; ++i)
+        CHECK(std::abs(out[i] - reference.out(static_cast<floating_t>(i) * wave_function::sample_length)) < 1e-2f);
+
+    return failures;
+}